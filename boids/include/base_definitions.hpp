@@ -7,6 +7,14 @@
 
 #include <entt/entt.hpp>
 
+// how the simulated world behaves at its edges
+enum class world_bounds
+{
+    screen,    // the window, boids are pushed back from its borders
+    toroidal,  // a world of fixed size whose edges wrap around
+    unbounded, // no edges at all
+};
+
 struct transform
 {
     Vector2 position;
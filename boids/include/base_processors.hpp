@@ -6,21 +6,62 @@
 #include <rlgl.h>
 
 #include <base_definitions.hpp>
+#include <cassert>
 #include <chrono>
 #include <cmath>
 #include <collision_definitions.hpp>
+#include <debug_draw.hpp>
 #include <entt/entt.hpp>
 #include <iostream>
+#include <job_system.hpp>
+#include <render_snapshot.hpp>
+#include <task_graph.hpp>
+
+// draws one renderable, its vertices are relative to position and rotated to face direction
+static void draw_renderable(Vector2 position, Vector2 direction, const Vector2* vertices, int vertex_count, Color color)
+{
+    static const Color border_color = ColorAlpha(BLACK, 0.5);
+
+    rlPushMatrix();
+    float angle = atan2(direction.y, direction.x) * RAD2DEG;
+    rlTranslatef(position.x, position.y, 0.0f);
+    rlRotatef(angle, 0.0f, 0.0f, 1.0f);
+
+    if (vertex_count == 3)
+    {
+        DrawTriangle(vertices[0], vertices[1], vertices[2], color);
+
+        // DrawCircleV(vertices[0], 1.4f, GREEN);
+        // DrawCircleV(vertices[1], 1.4f, RED);
+        // DrawCircleV(vertices[2], 1.6f, BLUE);
+
+        DrawTriangleLines(vertices[0], vertices[1], vertices[2], border_color);
+    }
+    // else if (vertex_count > 3)
+    //          {
+    //              for (int i = 0; i < vertex_count; i++)
+    //              {
+    //                  DrawLineEx(vertices[i], vertices[(i + 1) % vertex_count], 1.0f, color);
+    //              }
+    //              for (int i = 0; i < vertex_count; i++)
+    //              {
+    //                  DrawCircleV(vertices[i], 1.2f, LIGHTGRAY);
+    //              }
+    //          }
+    // DrawCircleV(Vector2Zero(), 1.2f, LIGHTGRAY);
+    rlPopMatrix();
+}
 
 struct render_process : entt::process<render_process, std::uint32_t>
 {
     using delta_type = std::uint32_t;
 
+    using reads  = component_list<transform, renderable>;
+    using writes = component_list<render_target>;
+
     render_process(entt::registry& registry) :
         registry(registry) {}
 
-    const Color border_color = ColorAlpha(BLACK, 0.5);
-
     void update(delta_type delta_time, void*)
     {
         auto start = std::chrono::high_resolution_clock::now();
@@ -28,70 +69,111 @@ struct render_process : entt::process<render_process, std::uint32_t>
         auto render_view = registry.view<transform, renderable>();
         for (auto [entity, transform, renderable] : render_view.each())
         {
-            std::vector<Vector2> vertices = renderable.vertices;
+            draw_renderable(transform.position, transform.direction, renderable.vertices.data(),
+                            static_cast<int>(renderable.vertices.size()), renderable.color);
+        }
 
-            rlPushMatrix();
-            float angle =
-                atan2(transform.direction.y, transform.direction.x) * RAD2DEG;
-            rlTranslatef(transform.position.x, transform.position.y, 0.0f);
-            rlRotatef(angle, 0.0f, 0.0f, 1.0f);
+        auto end      = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        std::cout << "render_process took " << duration.count() << " microseconds" << std::endl;
+    }
 
-            if (renderable.vertices.size() == 3)
-            {
-                DrawTriangle(vertices[0], vertices[1], vertices[2],
-                             renderable.color);
+   protected:
+    entt::registry& registry;
+};
 
-                // DrawCircleV(vertices[0], 1.4f, GREEN);
-                // DrawCircleV(vertices[1], 1.4f, RED);
-                // DrawCircleV(vertices[2], 1.6f, BLUE);
+// Pipelined rendering, replaces render_process. Draws the front render_snapshot, so unlike render_process it
+// doesn't wait for anything that writes transform and the whole simulation of the frame runs on the workers
+// meanwhile. What it draws is one frame behind the simulation.
+struct snapshot_render_process : entt::process<snapshot_render_process, std::uint32_t>
+{
+    using delta_type = std::uint32_t;
 
-                DrawTriangleLines(vertices[0], vertices[1], vertices[2], border_color);
-            }
-            // else if (renderable.vertices.size() > 3)
-            //          {
-            //              for (int i = 0; i < renderable.vertices.size(); i++)
-            //              {
-            //                  DrawLineEx(renderable.vertices[i],
-            //                             renderable.vertices[(i + 1) %
-            //                                                 renderable.vertices.size()],
-            //                             1.0f, renderable.color);
-            //              }
-            //              for (auto vertex : vertices)
-            //              {
-            //                  DrawCircleV(vertex, 1.2f, LIGHTGRAY);
-            //              }
-            //          }
-            // DrawCircleV(Vector2Zero(), 1.2f, LIGHTGRAY);
-            rlPopMatrix();
+    using reads  = component_list<render_snapshots::front_buffer>;
+    using writes = component_list<render_target>;
+
+    snapshot_render_process(entt::registry& registry) :
+        snapshots(registry.ctx().emplace<render_snapshots>()) {}
+
+    void update(delta_type delta_time, void*)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        const auto& snapshot = snapshots.front();
+        for (const auto& instance : snapshot.instances)
+        {
+            draw_renderable(instance.position, instance.direction, snapshot.vertices.data() + instance.first_vertex,
+                            instance.vertex_count, instance.color);
         }
 
         auto end      = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-        std::cout << "render_process took " << duration.count() << " microseconds" << std::endl;
+        std::cout << "snapshot_render_process took " << duration.count() << " microseconds" << std::endl;
+    }
+
+   protected:
+    render_snapshots& snapshots;
+};
+
+// Copies the state the frame ends with into the back render_snapshot, attach it after every process that
+// writes transform or renderable. Swap the snapshots after the frame.
+struct snapshot_capture_process : entt::process<snapshot_capture_process, std::uint32_t>
+{
+    using delta_type = std::uint32_t;
+
+    using reads  = component_list<transform, renderable>;
+    using writes = component_list<render_snapshots::back_buffer>;
+
+    snapshot_capture_process(entt::registry& registry) :
+        registry(registry),
+        snapshots(registry.ctx().emplace<render_snapshots>()) {}
+
+    void update(delta_type delta_time, void*)
+    {
+        snapshots.back().capture(registry);
     }
 
    protected:
     entt::registry& registry;
+    render_snapshots& snapshots;
 };
 
+// parallel runs the entities in chunks of grain_size on the registry's job_system, 1024 entities is about 32 KiB
+// of transform and movement, so a chunk stays in the L1 cache
 struct movement_process : entt::process<movement_process, std::uint32_t>
 {
     using delta_type = std::uint32_t;
 
-    movement_process(entt::registry& registry) :
-        registry(registry) {}
+    using reads  = component_list<movement>;
+    using writes = component_list<transform>;
+
+    movement_process(entt::registry& registry, bool parallel = false) :
+        registry(registry),
+        parallel(parallel),
+        jobs(registry.ctx().emplace<job_system>()) {}
 
     void update(delta_type delta_time, void*)
     {
         auto start = std::chrono::high_resolution_clock::now();
 
         auto movement_view = registry.view<transform, movement>();
-        for (auto [entity, transform, movement] : movement_view.each())
+        if (parallel)
         {
-            transform.position = Vector2Add(
-                transform.position,
-                Vector2Scale(movement.velocity, delta_time / 1000.0f));
-            transform.direction = Vector2Normalize(movement.velocity);
+            entities.assign(movement_view.begin(), movement_view.end());
+
+            jobs.parallel_for(static_cast<int>(entities.size()), grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    auto [transform, movement] = movement_view.get<::transform, ::movement>(entities[i]);
+                    move(transform, movement, delta_time);
+                }
+            });
+        } else
+        {
+            for (auto [entity, transform, movement] : movement_view.each())
+            {
+                move(transform, movement, delta_time);
+            }
         }
 
         auto end      = std::chrono::high_resolution_clock::now();
@@ -99,14 +181,47 @@ struct movement_process : entt::process<movement_process, std::uint32_t>
         std::cout << "movement_process took " << duration.count() << " microseconds" << std::endl;
     }
 
+    // one entity's step, shared with the fused pass of boids::fused_integration_process
+    static void move(transform& transform, const movement& movement, delta_type delta_time)
+    {
+        transform.position = Vector2Add(
+            transform.position,
+            Vector2Scale(movement.velocity, delta_time / 1000.0f));
+        transform.direction = Vector2Normalize(movement.velocity);
+    }
+
+    int grain_size = 1024;
+
    protected:
     entt::registry& registry;
+    bool parallel;
+    job_system& jobs;
+    std::vector<entt::entity> entities;
+};
+
+// Draws the overlays the simulation processes recorded this frame, attach it to the render scheduler
+struct debug_draw_process : entt::process<debug_draw_process, std::uint32_t>
+{
+    using delta_type = std::uint32_t;
+
+    using reads  = component_list<>;
+    using writes = component_list<debug_draw_buffer, render_target>;
+
+    debug_draw_process() = default;
+
+    void update(delta_type delta_time, void*)
+    {
+        debug_draw_buffer::instance().flush();
+    }
 };
 
 struct vision_process : entt::process<vision_process, std::uint32_t>
 {
     using delta_type = std::uint32_t;
 
+    using reads  = component_list<transform, movement, rect_collider>;
+    using writes = component_list<debug_draw_buffer>;
+
     vision_process(entt::registry& registry) :
         registry(registry) {}
 
@@ -119,8 +234,8 @@ struct vision_process : entt::process<vision_process, std::uint32_t>
             if (raycast(registry, transform.position, transform.direction, hit_points, 100))
             {
                 RayCollision closest_hit = hit_points[0];
-                DrawLineEx(transform.position,
-                           {closest_hit.point.x, closest_hit.point.y}, 1.0f, RED);
+                debug_draw_buffer::instance().line(transform.position,
+                                                   {closest_hit.point.x, closest_hit.point.y}, 1.0f, RED);
             }
         }
     }
@@ -133,11 +248,24 @@ struct boids_constraints_process : entt::process<boids_constraints_process, std:
 {
     using delta_type = std::uint32_t;
 
-    boids_constraints_process(entt::registry& registry) :
-        registry(registry)
+    using reads  = component_list<>;
+    using writes = component_list<transform, movement>;
+
+    // world_width/world_height are only used by toroidal worlds, screen worlds always use the window size.
+    // Toroidal worlds wrap at exactly that size, pass the one of the toroidal grid (its window_width and
+    // window_height, rounded up to whole cells) so the seam is where nearest_image expects it.
+    // parallel chunks the entities like movement_process
+    boids_constraints_process(entt::registry& registry, world_bounds bounds = world_bounds::screen,
+                              int world_width = 0, int world_height = 0, bool parallel = false) :
+        registry(registry),
+        bounds(bounds),
+        parallel(parallel),
+        jobs(registry.ctx().emplace<job_system>())
     {
-        screen_width  = GetScreenWidth();
-        screen_height = GetScreenHeight();
+        assert(bounds != world_bounds::toroidal || (world_width > 0 && world_height > 0));
+
+        screen_width  = bounds == world_bounds::toroidal ? world_width : GetScreenWidth();
+        screen_height = bounds == world_bounds::toroidal ? world_height : GetScreenHeight();
     }
 
     void update(delta_type delta_time, void*)
@@ -145,77 +273,114 @@ struct boids_constraints_process : entt::process<boids_constraints_process, std:
         auto start = std::chrono::high_resolution_clock::now();
 
         auto moving_entities_view = registry.view<transform, movement>();
-
-        for (auto [entity, transform_data, movement_data] : moving_entities_view.each())
+        if (parallel)
         {
-            Vector2 center_direction = Vector2Subtract(Vector2{screen_width * 0.5f, screen_height * 0.5f}, transform_data.position);
-            center_direction         = Vector2Normalize(center_direction);
-            bool override_velocity   = false;
-
-            if (transform_data.position.x < 0)
-            {
-                movement_data.velocity.x *= center_direction.x;
-                transform_data.position.x = 0;
-            } else if (transform_data.position.x > screen_width)
+            entities.assign(moving_entities_view.begin(), moving_entities_view.end());
+
+            jobs.parallel_for(static_cast<int>(entities.size()), grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    auto [transform_data, movement_data] = moving_entities_view.get<transform, movement>(entities[i]);
+                    constrain(transform_data, movement_data);
+                }
+            });
+        } else
+        {
+            for (auto [entity, transform_data, movement_data] : moving_entities_view.each())
             {
-                movement_data.velocity.x *= center_direction.x;
-                transform_data.position.x = screen_width;
+                constrain(transform_data, movement_data);
             }
+        }
 
-            if (transform_data.position.y < 0)
-            {
-                movement_data.velocity.y *= center_direction.y;
-                transform_data.position.y = 0;
-            } else if (transform_data.position.y > screen_height)
-            {
-                movement_data.velocity.y *= center_direction.y;
-                transform_data.position.y = screen_height;
-            }
+        auto end      = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        std::cout << "boids_constraints_process took " << duration.count() << " microseconds" << std::endl;
+    }
 
-            float turnfactor = 1;
-            float border     = 50;
+    // one entity's step, shared with the fused pass of boids::fused_integration_process
+    void constrain(transform& transform_data, movement& movement_data) const
+    {
+        Vector2 center_direction = Vector2Subtract(Vector2{screen_width * 0.5f, screen_height * 0.5f}, transform_data.position);
+        center_direction         = Vector2Normalize(center_direction);
+        bool override_velocity   = false;
 
-            if (transform_data.position.x < border)
-            {
-                movement_data.velocity.x += turnfactor;
-            }
+        if (bounds == world_bounds::toroidal)
+        {
+            transform_data.position.x -= std::floor(transform_data.position.x / screen_width) * screen_width;
+            transform_data.position.y -= std::floor(transform_data.position.y / screen_height) * screen_height;
+        } else if (bounds == world_bounds::screen)
+        {
+            clamp_to_screen(transform_data, movement_data, center_direction);
+        }
 
-            if (transform_data.position.x > screen_width - border)
-            {
-                movement_data.velocity.x -= turnfactor;
-            }
+        auto speed = Vector2Length(movement_data.velocity);
 
-            if (transform_data.position.y < border)
-            {
-                movement_data.velocity.y += turnfactor;
-            }
+        if (speed <= 1)
+            movement_data.velocity = center_direction;
 
-            if (transform_data.position.y > screen_height - border)
-            {
-                movement_data.velocity.y -= turnfactor;
-            }
+        if (!(speed >= min_speed && speed <= max_speed))
+        {
+            speed                  = std::clamp(speed, min_speed, max_speed);
+            movement_data.velocity = Vector2Scale(Vector2Normalize(movement_data.velocity), speed);
+        }
 
-            auto speed = Vector2Length(movement_data.velocity);
+        movement_data.old_velocity = movement_data.velocity;
+    }
 
-            if (speed <= 1)
-                movement_data.velocity = center_direction;
+    int grain_size = 1024;
 
-            if (!(speed >= min_speed && speed <= max_speed))
-            {
-                speed                  = std::clamp(speed, min_speed, max_speed);
-                movement_data.velocity = Vector2Scale(Vector2Normalize(movement_data.velocity), speed);
-            }
+   protected:
+    void clamp_to_screen(transform& transform_data, movement& movement_data, Vector2 center_direction) const
+    {
+        if (transform_data.position.x < 0)
+        {
+            movement_data.velocity.x *= center_direction.x;
+            transform_data.position.x = 0;
+        } else if (transform_data.position.x > screen_width)
+        {
+            movement_data.velocity.x *= center_direction.x;
+            transform_data.position.x = screen_width;
+        }
 
-            movement_data.old_velocity = movement_data.velocity;
+        if (transform_data.position.y < 0)
+        {
+            movement_data.velocity.y *= center_direction.y;
+            transform_data.position.y = 0;
+        } else if (transform_data.position.y > screen_height)
+        {
+            movement_data.velocity.y *= center_direction.y;
+            transform_data.position.y = screen_height;
         }
 
-        auto end      = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-        std::cout << "boids_constraints_process took " << duration.count() << " microseconds" << std::endl;
+        float turnfactor = 1;
+        float border     = 50;
+
+        if (transform_data.position.x < border)
+        {
+            movement_data.velocity.x += turnfactor;
+        }
+
+        if (transform_data.position.x > screen_width - border)
+        {
+            movement_data.velocity.x -= turnfactor;
+        }
+
+        if (transform_data.position.y < border)
+        {
+            movement_data.velocity.y += turnfactor;
+        }
+
+        if (transform_data.position.y > screen_height - border)
+        {
+            movement_data.velocity.y -= turnfactor;
+        }
     }
 
-   protected:
     entt::registry& registry;
+    world_bounds bounds;
+    bool parallel;
+    job_system& jobs;
+    std::vector<entt::entity> entities;
     int screen_width;
     int screen_height;
     float min_speed = 10;
@@ -5,12 +5,19 @@
 #include <raymath.h>
 
 #include <algorithm>
+#include <atomic>
 #include <base_definitions.hpp>
 #include <boids_definitions.hpp>
 #include <cmath>
+#include <counter_rng.hpp>
+#include <debug_draw.hpp>
 #include <entt/entt.hpp>
-#include <execution>
+#include <job_system.hpp>
+#include <neighbor_kernels.hpp>
+#include <numeric>
 #include <stack>
+#include <steering_rules.hpp>
+#include <task_graph.hpp>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -36,18 +43,18 @@ namespace boids
     }
 
     static void create_n_boids(entt::registry& registry, int n,
-                               Vector2 spawn_position, float spawn_radius)
+                               Vector2 spawn_position, float spawn_radius,
+                               const boids::grid& boids_grid = boids::grid(40),
+                               uint64_t seed = default_seed)
     {
-        auto random_float = [](float min, float max) -> float {
-            float random = rand() / (float)RAND_MAX;
-            return random * (max - min) + min;
-        };
+        // spawn values are drawn at frame 0, the simulation frames start at 1
+        counter_rng rng(seed);
 
         int side     = 10;
         float height = sqrt(pow(side, 2) - pow(side / 2, 2));
 
         auto grid = registry.create();
-        registry.emplace<boids::grid>(grid, boids::grid(40));
+        registry.emplace<boids::grid>(grid, boids_grid);
         auto grid_data = registry.get<boids::grid>(grid);
 
         Vector2 v1 = Vector2{0 - height / 2, 0 - side / 2.0f};
@@ -59,11 +66,11 @@ namespace boids
         for (int i = 0; i < n; i++)
         {
             Vector2 position =
-                Vector2{random_float(-spawn_radius / 2, spawn_radius / 2),
-                        random_float(-spawn_radius / 2, spawn_radius / 2)};
+                Vector2{rng.uniform(i, 0, 0, -spawn_radius / 2, spawn_radius / 2),
+                        rng.uniform(i, 0, 1, -spawn_radius / 2, spawn_radius / 2)};
             position = Vector2Add(position, spawn_position);
 
-            Vector2 direction = Vector2{random_float(-1, 1), random_float(-1, 1)};
+            Vector2 direction = Vector2{rng.uniform(i, 0, 2, -1, 1), rng.uniform(i, 0, 3, -1, 1)};
 
             auto hash = grid_data.hash_position(position);
 
@@ -74,17 +81,125 @@ namespace boids
         }
     }
 
-    // separation process
-    struct boid_algo_process : entt::process<boid_algo_process, std::uint32_t>
+    // Where the target rule steers the boids to. boid_algo_process takes it from the registry context when it's
+    // there and reads the mouse itself otherwise. A simulation running while the main thread is in EndDrawing,
+    // which polls the input, can't read the mouse, so the main thread samples it into this instead.
+    struct steering_target
+    {
+        Vector2 position;
+    };
+
+    // how boid_algo_process walks the neighbors of every boid
+    enum class neighbor_traversal
+    {
+        per_boid,  // every boid queries the grid around itself, each pair is tested from both sides
+        pairs,     // each unordered pair is tested once over a half stencil, flat grid backends only
+        streamed,  // per boid, but reading neighbors from the grid's SoA block, flat grid backends only
+        verlet,    // per boid lists of the neighbors inside cohesion_radius + verlet_skin, reused over frames
+        far_field, // streamed, plus the cell aggregates of the farther cells up to far_field_radius
+        nearest,   // topological: the nearest_count closest boids, found over growing rings of cells
+    };
+
+    // The Capacity smallest (key, value) pairs offered so far, kept as a max heap in a fixed array so it can
+    // live on the stack of a per boid loop
+    template <int Capacity>
+    struct bounded_heap
+    {
+        std::pair<float, int> items[Capacity];
+        int size     = 0;
+        int capacity = Capacity;
+
+        explicit bounded_heap(int capacity) :
+            capacity(std::clamp(capacity, 0, Capacity))
+        {
+        }
+
+        bool full() const
+        {
+            return size == capacity;
+        }
+
+        // largest key kept, only meaningful when full
+        float top() const
+        {
+            return items[0].first;
+        }
+
+        void offer(float key, int value)
+        {
+            if (size < capacity)
+            {
+                items[size++] = {key, value};
+                std::push_heap(items, items + size);
+            } else if (capacity > 0 && key < top())
+            {
+                std::pop_heap(items, items + size);
+                items[size - 1] = {key, value};
+                std::push_heap(items, items + size);
+            }
+        }
+    };
+
+    // Flocking: gathers the neighbors of every boid and steers it with the rules of Pipeline, see
+    // steering_rules.hpp. Neighbors inside separation_radius are "near", inside cohesion_radius they
+    // are part of the neighborhood.
+    template <typename Pipeline>
+    struct basic_boid_algo_process : entt::process<basic_boid_algo_process<Pipeline>, std::uint32_t>
     {
         using delta_type = std::uint32_t;
 
-        boid_algo_process(entt::registry& registry) :
-            registry(registry)
+        using reads  = component_list<transform, boid>;
+        using writes = component_list<movement, grid, debug_draw_buffer>;
+
+        // neighbor contributions gathered for one boid before the forces are computed
+        using neighbor_sums = typename Pipeline::state;
+
+        // most boids the nearest traversal keeps per boid, the size of its fixed heap
+        static constexpr int max_nearest_count = 16;
+
+        // isa picks the neighbor kernel of the streamed traversal, automatic takes the best one the cpu runs.
+        // Boids only see the neighbors within vision_half_angle (radians) of their heading, PI sees all around.
+        // Boids recompute their steering at most every max_steering_period frames (rounded down to a power of
+        // two), see schedule_steering, 1 recomputes every boid every frame. The far_field traversal counts the
+        // boids out to far_field_radius, see update_streamed. The nearest traversal takes the nearest_count
+        // closest boids inside nearest_radius, nearest_count is clamped to [1, max_nearest_count].
+        basic_boid_algo_process(entt::registry& registry, neighbor_traversal traversal = neighbor_traversal::per_boid,
+                                simd_isa isa = simd_isa::automatic, uint64_t seed = default_seed,
+                                float vision_half_angle = PI, int max_steering_period = 1,
+                                float far_field_radius = 160.0f, int nearest_count = 7, float nearest_radius = 160.0f,
+                                Pipeline pipeline = Pipeline()) :
+            registry(registry),
+            traversal(traversal),
+            vision_half_angle(vision_half_angle),
+            vision_cos(vision_half_angle >= PI ? -1.0f : std::cos(vision_half_angle)),
+            jobs(registry.ctx().emplace<job_system>()),
+            pipeline(pipeline)
         {
+            this->max_steering_period = 1;
+            while (this->max_steering_period * 2 <= max_steering_period)
+                this->max_steering_period *= 2;
+
+            this->far_field_radius = far_field_radius;
+            this->nearest_count    = std::clamp(nearest_count, 1, max_nearest_count);
+            this->nearest_radius   = nearest_radius;
+
+            if constexpr (Pipeline::template has<noise_rule>)
+                this->pipeline.template get<noise_rule>().rng = counter_rng(seed);
+
+            kernel_isa = resolve_simd_isa(isa);
+            accumulate = get_neighbor_kernel(kernel_isa);
+            std::cout << "boid_algo_process: " << simd_isa_name(kernel_isa) << " neighbor kernel" << std::endl;
+
             // WARN: We assume that the screen size is not going to change
             screen_width  = GetScreenWidth();
             screen_height = GetScreenHeight();
+
+            // so the first hashing pass already builds the aggregates far_field reads
+            if (traversal == neighbor_traversal::far_field)
+            {
+                for (auto [entity, grid_data] : registry.view<grid>().each())
+                    grid_data.builds_cell_aggregates = true;
+            }
         }
 
         void update(delta_type delta_time, void*)
@@ -93,164 +208,986 @@ namespace boids
 
             auto boids_view = registry.view<transform, movement, boid>();
             auto grid_view  = registry.view<boids::grid>();
-            auto grid_data  = grid_view.get<boids::grid>(grid_view.front());
+            auto& grid_data = grid_view.get<boids::grid>(grid_view.front());
+
+            const auto* target = registry.ctx().find<steering_target>();
+            target_pos         = target != nullptr ? target->position : GetMousePosition();
+            frame++;
+
+            schedule_steering();
+
+            const bool far_field = traversal == neighbor_traversal::far_field;
+            if ((traversal == neighbor_traversal::streamed || far_field) && grid_data.backend != grid_backend::hash_map)
+            {
+                long long far_cells  = 0;
+                long long candidates = update_streamed(grid_data, delta_time, far_field, far_cells);
+
+                grid_data.candidate_count = candidates;
+                grid_data.query_count     = steering_updates;
+
+                auto end      = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+                std::cout << "boid_algo_process took " << duration.count() << " microseconds, candidates " << candidates;
+                if (far_field)
+                    std::cout << ", far cells " << far_cells;
+                std::cout << std::endl;
+                return;
+            }
+
+            if (traversal == neighbor_traversal::nearest && grid_data.backend != grid_backend::hash_map)
+            {
+                long long rings      = 0;
+                long long candidates = update_nearest(grid_data, delta_time, rings);
 
-            float separation_radius = 30.0f;
-            float cohesion_radius   = 80.0f;
+                grid_data.candidate_count = candidates;
+                grid_data.query_count     = steering_updates;
 
-            Vector2 target_pos = GetMousePosition();
+                auto end      = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+                std::cout << "boid_algo_process took " << duration.count() << " microseconds, candidates " << candidates
+                          << ", rings " << rings << std::endl;
+                return;
+            }
+
+            if (traversal == neighbor_traversal::verlet)
+            {
+                bool rebuilt = update_verlet(grid_data, delta_time);
+
+                grid_data.neighbor_list_frames++;
+                grid_data.neighbor_list_rebuilds += rebuilt;
+
+                auto end      = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+                std::cout << "boid_algo_process took " << duration.count() << " microseconds, neighbors " << verlet_neighbors.size()
+                          << (rebuilt ? ", lists rebuilt" : ", lists reused") << " (" << grid_data.neighbor_list_rebuilds << " rebuilds in "
+                          << grid_data.neighbor_list_frames << " frames)" << std::endl;
+                return;
+            }
+
+            if (traversal == neighbor_traversal::pairs && grid_data.backend != grid_backend::hash_map)
+            {
+                long long pairs = update_pairs(grid_data, delta_time);
+
+                grid_data.candidate_count = 2 * pairs;
+                grid_data.query_count     = steering_updates;
+
+                auto end      = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+                std::cout << "boid_algo_process took " << duration.count() << " microseconds, pairs " << pairs << std::endl;
+                return;
+            }
+
+            // One coarse query over the reach of every rule serves them all, unless the grid has a finer level
+            // for the short range separation rule (see grid::add_level). Then the coarse query only feeds
+            // cohesion and alignment and separation gets its own query on the fine level, so the separation
+            // test runs on the boids of a few small cells instead of on every coarse candidate.
+            auto& separation_grid          = grid_data.level_for_radius(separation_radius);
+            const bool split_queries       = &separation_grid != &grid_data;
+            const auto& separation_stencil = separation_grid.get_stencil(separation_radius);
+
+            const float neighbor_radius  = split_queries ? cohesion_radius : std::max(cohesion_radius, separation_radius);
+            const auto& neighbor_stencil = grid_data.get_stencil(neighbor_radius);
+
+            std::atomic<long long> cohesion_candidates   = 0;
+            std::atomic<long long> separation_candidates = 0;
 
             // TODO: remove unecesarry operation already calcualted in grid data process
 
             auto parallel_func = [&](auto& entity) {
                 transform& transform_data = registry.get<transform>(entity);
-                movement& movement_data   = registry.get<movement>(entity);
                 boid& boid_data           = registry.get<boid>(entity);
 
-                std::unordered_set<entt::entity> close_boids;
+                neighbor_sums sums;
 
-                int cohesion_boids_count        = 0;
-                Vector2 local_cohesion_center   = Vector2{0, 0};
-                Vector2 local_cohesion_velocity = Vector2{0, 0};
+                if (!recomputes_steering(boid_data.id))
+                {
+                    steer(entity, sums, delta_time);
+                    return;
+                }
 
-                int separation_boids_count    = 0;
-                Vector2 local_sepation_center = Vector2{0, 0};
+                const view_cone cone = vision(transform_data.direction);
 
-                auto cell_id     = boid_data.current_cell_id;
-                auto close_cells = grid_data.get_close_cells(cell_id);
-                close_cells.push_back(cell_id);
+                long long candidates = 0;
 
-                for (auto id : close_cells)
+                grid_data.for_each_neighbor(transform_data.position, neighbor_radius, neighbor_stencil, [&](entt::entity close_boid) {
+                    if (close_boid == entity)
+                        return;
+
+                    candidates++;
+
+                    const Vector2 close_boid_position = grid_data.nearest_image(transform_data.position, registry.get<transform>(close_boid).position);
+                    if (!cone.contains(Vector2Subtract(close_boid_position, transform_data.position)))
+                        return;
+
+                    const auto& close_boid_movement = registry.get<movement>(close_boid);
+
+                    steering_neighbor neighbor;
+                    neighbor.position         = close_boid_position;
+                    neighbor.velocity         = close_boid_movement.old_velocity;
+                    neighbor.distance_squared = Vector2DistanceSqr(close_boid_position, transform_data.position);
+
+                    if (!split_queries && neighbor.distance_squared < separation_radius * separation_radius)
+                    {
+                        pipeline.accumulate_near(sums, neighbor);
+                    }
+
+                    if (neighbor.distance_squared < cohesion_radius * cohesion_radius)
+                    {
+                        pipeline.accumulate(sums, neighbor);
+                    }
+
+                    if constexpr (debug_draw_enabled)
+                    {
+                        if (boid_data.id == debug_boid_id)
+                            debug_draw_buffer::instance().line(transform_data.position, close_boid_position, 2, LIME);
+                    }
+                }, cone);
+
+                cohesion_candidates.fetch_add(candidates, std::memory_order_relaxed);
+
+                if (split_queries)
+                {
+                    candidates = 0;
+
+                    separation_grid.for_each_neighbor(transform_data.position, separation_radius, separation_stencil, [&](entt::entity close_boid) {
+                        if (close_boid == entity)
+                            return;
+
+                        candidates++;
+
+                        steering_neighbor neighbor;
+                        neighbor.position = grid_data.nearest_image(transform_data.position, registry.get<transform>(close_boid).position);
+                        if (!cone.contains(Vector2Subtract(neighbor.position, transform_data.position)))
+                            return;
+
+                        neighbor.velocity         = registry.get<movement>(close_boid).old_velocity;
+                        neighbor.distance_squared = Vector2DistanceSqr(neighbor.position, transform_data.position);
+
+                        if (neighbor.distance_squared < separation_radius * separation_radius)
+                        {
+                            pipeline.accumulate_near(sums, neighbor);
+                        }
+                    }, cone);
+                }
+
+                separation_candidates.fetch_add(candidates, std::memory_order_relaxed);
+
+                steer(entity, sums, delta_time);
+            };
+
+            boid_entities.assign(boids_view.begin(), boids_view.end());
+
+            jobs.parallel_for(static_cast<int>(boid_entities.size()), grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
                 {
-                    std::unordered_set<entt::entity> cell_boids;
-                    grid_data.get_boids_in_cell(id, cell_boids);
+                    parallel_func(boid_entities[i]);
+                }
+            });
+
+            grid_data.candidate_count = split_queries ? cohesion_candidates + separation_candidates
+                                                      : cohesion_candidates.load();
+            grid_data.query_count     = steering_updates;
+
+            auto end      = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+            std::cout << "boid_algo_process took " << duration.count() << " microseconds, candidates (separation "
+                      << separation_candidates << ", cohesion " << cohesion_candidates << ")" << std::endl;
+        }
+
+        // What update_streamed adds up for the boid at grid::state index i: exact(first, end) gets every range of
+        // state the kernel streams over and aggregate(slot, cell) every cell_aggregates slot added as a whole,
+        // its position_sum already shifted to the nearest image. Uses the stencils of the last update.
+        template <typename Exact, typename Aggregate>
+        void for_each_streamed_source(grid& grid_data, int i, bool far_field, const view_cone& cone, Exact&& exact, Aggregate&& aggregate)
+        {
+            const Vector2 position = Vector2{grid_data.state.pos_x[i], grid_data.state.pos_y[i]};
+
+            // the near cells are pruned at the radius the kernel counts out to, every cell the far ring doesn't
+            // cover has to be streamed when a boid of it can be inside far_field_radius
+            const float radius = far_field ? std::max(far_field_radius, cohesion_radius) : cohesion_radius;
+
+            grid_data.for_each_neighbor_range(position, radius, near_stencil, exact, cone);
+
+            if (!far_field)
+                return;
 
-                    close_boids.insert(cell_boids.begin(), cell_boids.end());
+            grid_data.for_each_stencil_cell(position, radius, far_ring, [&](int cell_id) {
+                const int slot = grid_data.cell_slot(cell_id);
+                if (slot == -1 || grid_data.cell_aggregates[slot].count == 0)
+                    return;
+
+                cell_aggregate cell = grid_data.cell_aggregates[slot];
+
+                const Vector2 center = Vector2Scale(cell.position_sum, 1.0f / cell.count);
+                const Vector2 image  = grid_data.nearest_image(position, center);
+
+                cell.position_sum = Vector2Add(cell.position_sum, Vector2Scale(Vector2Subtract(image, center), static_cast<float>(cell.count)));
+
+                aggregate(slot, cell);
+            }, cone);
+        }
+
+       protected:
+        // Per boid traversal over grid::state: the neighbor kernel only streams over the contiguous floats of
+        // the stencil cells, the sums are then turned into velocities in one linear pass over the boids.
+        // Finer grid levels are ignored, their entries are not in state order. Returns the candidates tested.
+        //
+        // With far_field the cells of the ring between the cohesion stencil and the far_field_radius stencil
+        // are added as a whole from grid::cell_aggregates (Barnes-Hut style), when some of the cell is inside
+        // far_field_radius. Only the cohesion and alignment rules read them. The boids of the cohesion stencil
+        // are still counted one by one, but out to far_field_radius: the stencil reaches past cohesion_radius
+        // and the ring starts where it ends, so every boid inside far_field_radius is counted exactly once,
+        // see check_far_field in main.cpp.
+        long long update_streamed(grid& grid_data, delta_type delta_time, bool far_field, long long& far_cells)
+        {
+            const auto& state       = grid_data.state;
+            const auto& entries     = grid_data.cell_entries;
+            const int entries_count = static_cast<int>(entries.size());
+            const int chunks        = job_system::chunk_count(entries_count, grain_size);
+
+            const bool wraps = grid_data.bounds == world_bounds::toroidal;
+            near_stencil     = grid_data.get_stencil(cohesion_radius);
+
+            const float far_radius = std::max(far_field_radius, cohesion_radius);
+
+            far_ring.clear();
+            if (far_field)
+            {
+                grid_data.builds_cell_aggregates = true;
+
+                for (const auto& offset : grid_data.get_stencil(far_field_radius))
+                {
+                    if (std::find(near_stencil.begin(), near_stencil.end(), offset) == near_stencil.end())
+                        far_ring.push_back(offset);
                 }
+            }
 
-                close_boids.erase(entity);
+            boid_sums.resize(entries_count);
+            std::vector<long long> chunk_candidates(chunks, 0);
+            std::vector<long long> chunk_far_cells(chunks, 0);
 
-                for (auto close_boid : close_boids)
+            jobs.parallel_for(entries_count, grain_size, [&](int chunk, int first, int last) {
+                for (int i = first; i < last; i++)
                 {
-                    auto close_boid_transform = registry.get<transform>(close_boid);
-                    auto close_boid_movement  = registry.get<movement>(close_boid);
+                    if (skips_steering(entries[i]))
+                        continue;
+
+                    kernel_query query;
+                    query.x                         = state.pos_x[i];
+                    query.y                         = state.pos_y[i];
+                    query.separation_radius_squared = separation_radius * separation_radius;
+                    query.cohesion_radius_squared   = far_field ? far_radius * far_radius : cohesion_radius * cohesion_radius;
+                    query.wrap_width                = wraps ? static_cast<float>(grid_data.window_width) : 0;
+                    query.wrap_height               = wraps ? static_cast<float>(grid_data.window_height) : 0;
+                    query.cone                      = vision(Vector2{state.dir_x[i], state.dir_y[i]});
+
+                    kernel_sums kernel_result;
+                    neighbor_sums far_sums;
+
+                    for_each_streamed_source(grid_data, i, far_field, query.cone, [&](int first, int end) {
+                        chunk_candidates[chunk] += end - first;
+
+                        // the boid itself is in its own cell's range, skip it
+                        if (first <= i && i < end)
+                        {
+                            accumulate(query, state, first, i, kernel_result);
+                            accumulate(query, state, i + 1, end, kernel_result);
+                        }
+                        else
+                        {
+                            accumulate(query, state, first, end, kernel_result);
+                        }
+                    }, [&](int, const cell_aggregate& cell) {
+                        pipeline.accumulate_far(far_sums, cell);
+                        chunk_far_cells[chunk]++;
+                    });
 
-                    auto close_boid_distance_squared = Vector2DistanceSqr(close_boid_transform.position, transform_data.position);
+                    // the boid itself
+                    chunk_candidates[chunk]--;
 
-                    if (close_boid_distance_squared < separation_radius * separation_radius)
+                    boid_sums[i] = neighbor_sums{};
+                    pipeline.accumulate_sums(boid_sums[i], kernel_result);
+                    pipeline.merge(boid_sums[i], far_sums);
+                }
+            });
+
+            jobs.parallel_for(entries_count, grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    steer(entries[i], boid_sums[i], delta_time);
+                }
+            });
+
+            far_cells = std::accumulate(chunk_far_cells.begin(), chunk_far_cells.end(), 0LL);
+
+            return std::accumulate(chunk_candidates.begin(), chunk_candidates.end(), 0LL);
+        }
+
+        // Topological neighborhood: the nearest_count closest boids inside nearest_radius, wherever they are.
+        // The cells around the boid are scanned one square ring at a time, ring r holds the cells at Chebyshev
+        // distance r from the boid's cell, so every boid beyond it is at least r * cell_size away. Once the heap
+        // is full and its farthest boid is closer than that, no outer ring can improve it. The cost per boid is
+        // then bounded by the density of the few innermost rings instead of the whole cohesion disc.
+        // Boids are indexed like grid::state. Returns the candidates tested, rings counts the rings scanned.
+        long long update_nearest(grid& grid_data, delta_type delta_time, long long& rings)
+        {
+            const auto& state       = grid_data.state;
+            const auto& entries     = grid_data.cell_entries;
+            const int entries_count = static_cast<int>(entries.size());
+            const int chunks        = job_system::chunk_count(entries_count, grain_size);
+
+            const float cell_size = static_cast<float>(grid_data.cell_size);
+
+            int max_ring = static_cast<int>(std::ceil(nearest_radius / cell_size));
+            if (grid_data.bounds == world_bounds::toroidal)
+            {
+                // past this the rings wrap onto cells already scanned
+                max_ring = std::min(max_ring, (std::min(grid_data.columns, grid_data.rows) - 1) / 2);
+            }
+
+            boid_sums.resize(entries_count);
+            std::vector<long long> chunk_candidates(chunks, 0);
+            std::vector<long long> chunk_rings(chunks, 0);
+
+            jobs.parallel_for(entries_count, grain_size, [&](int chunk, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    if (skips_steering(entries[i]))
+                        continue;
+
+                    const Vector2 position = Vector2{state.pos_x[i], state.pos_y[i]};
+                    const view_cone cone   = vision(Vector2{state.dir_x[i], state.dir_y[i]});
+                    auto [x, y]            = grid_data.position_to_index(position);
+
+                    bounded_heap<max_nearest_count> nearest(nearest_count);
+
+                    auto scan_cell = [&](int cell_x, int cell_y) {
+                        const int cell_id = grid_data.index_to_cell_id(cell_x, cell_y);
+                        const int slot    = cell_id == -1 ? -1 : grid_data.cell_slot(cell_id);
+                        if (slot == -1)
+                            return;
+
+                        const int first = grid_data.cell_start[slot];
+                        const int end   = first + grid_data.cell_length[slot];
+                        for (int j = first; j < end; j++)
+                        {
+                            if (j == i)
+                            {
+                                chunk_candidates[chunk]--;
+                                continue;
+                            }
+
+                            const Vector2 image = grid_data.nearest_image(position, Vector2{state.pos_x[j], state.pos_y[j]});
+                            const float distance_squared = Vector2DistanceSqr(image, position);
+                            if (distance_squared < nearest_radius * nearest_radius && cone.contains(Vector2Subtract(image, position)))
+                                nearest.offer(distance_squared, j);
+                        }
+                        chunk_candidates[chunk] += end - first;
+                    };
+
+                    for (int ring = 0; ring <= max_ring; ring++)
                     {
-                        local_sepation_center = Vector2Add(local_sepation_center, close_boid_transform.position);
+                        // the boids not scanned yet are at least this far
+                        const float unscanned_distance = (ring - 1) * cell_size;
+                        if (ring > 0 && nearest.full() && nearest.top() <= unscanned_distance * unscanned_distance)
+                            break;
+
+                        chunk_rings[chunk]++;
+
+                        if (ring == 0)
+                        {
+                            scan_cell(x, y);
+                            continue;
+                        }
 
-                        separation_boids_count++;
+                        for (int d = -ring; d <= ring; d++)
+                        {
+                            scan_cell(x + d, y - ring);
+                            scan_cell(x + d, y + ring);
+                        }
+                        for (int d = -ring + 1; d <= ring - 1; d++)
+                        {
+                            scan_cell(x - ring, y + d);
+                            scan_cell(x + ring, y + d);
+                        }
                     }
 
-                    if (close_boid_distance_squared < cohesion_radius * cohesion_radius)
+                    neighbor_sums sums;
+
+                    for (int n = 0; n < nearest.size; n++)
                     {
-                        local_cohesion_center   = Vector2Add(local_cohesion_center, close_boid_transform.position);
-                        local_cohesion_velocity = Vector2Add(local_cohesion_velocity, close_boid_movement.old_velocity);
+                        const auto [distance_squared, j] = nearest.items[n];
+
+                        steering_neighbor neighbor;
+                        neighbor.position         = grid_data.nearest_image(position, Vector2{state.pos_x[j], state.pos_y[j]});
+                        neighbor.velocity         = Vector2{state.vel_x[j], state.vel_y[j]};
+                        neighbor.distance_squared = distance_squared;
 
-                        cohesion_boids_count++;
+                        if (distance_squared < separation_radius * separation_radius)
+                        {
+                            pipeline.accumulate_near(sums, neighbor);
+                        }
+
+                        pipeline.accumulate(sums, neighbor);
                     }
 
-                    if (boid_data.id == debug_boid_id)
+                    boid_sums[i] = sums;
+                }
+            });
+
+            jobs.parallel_for(entries_count, grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    steer(entries[i], boid_sums[i], delta_time);
+                }
+            });
+
+            rings = std::accumulate(chunk_rings.begin(), chunk_rings.end(), 0LL);
+
+            return std::accumulate(chunk_candidates.begin(), chunk_candidates.end(), 0LL);
+        }
+
+        // Verlet lists: every boid keeps the boids that were inside cohesion_radius + verlet_skin when the lists
+        // were built. Until some boid has moved more than half the skin no pair can have closed that margin, so
+        // the lists still hold every neighbor inside cohesion_radius and the grid isn't queried at all.
+        // Boids are indexed by their position in verlet_owners. The lists are also rebuilt when the set of boids
+        // changed: with the count unchanged, every owner still being a boid means it's the same set.
+        // Returns whether the lists were rebuilt.
+        bool update_verlet(grid& grid_data, delta_type delta_time)
+        {
+            auto boids_view = registry.view<transform, movement, boid>();
+
+            bool rebuild = verlet_owners.size() != boids_view.size_hint() || verlet_owners.empty();
+
+            if (!rebuild)
+            {
+                const int owners_count = static_cast<int>(verlet_owners.size());
+
+                std::vector<float> chunk_displacement(job_system::chunk_count(owners_count, grain_size), 0);
+                std::vector<char> chunk_stale(chunk_displacement.size(), 0);
+
+                jobs.parallel_for(owners_count, grain_size, [&](int chunk, int first, int last) {
+                    for (int i = first; i < last; i++)
                     {
-                        DrawLineEx(transform_data.position, close_boid_transform.position, 2, LIME);
+                        // contains checks the version too, so an owner destroyed and its id reused also shows here
+                        if (!boids_view.contains(verlet_owners[i]))
+                        {
+                            chunk_stale[chunk] = 1;
+                            return;
+                        }
+
+                        verlet_positions[i]  = boids_view.get<transform>(verlet_owners[i]).position;
+                        verlet_velocities[i] = boids_view.get<movement>(verlet_owners[i]).old_velocity;
+                        verlet_directions[i] = boids_view.get<transform>(verlet_owners[i]).direction;
+
+                        const Vector2 moved       = grid_data.nearest_image(verlet_reference[i], verlet_positions[i]);
+                        chunk_displacement[chunk] = std::max(chunk_displacement[chunk], Vector2DistanceSqr(moved, verlet_reference[i]));
                     }
-                }
+                });
+
+                const float max_displacement = *std::max_element(chunk_displacement.begin(), chunk_displacement.end());
+                const bool stale             = std::find(chunk_stale.begin(), chunk_stale.end(), 1) != chunk_stale.end();
+                rebuild                      = stale || max_displacement > verlet_skin * verlet_skin / 4;
+            }
 
-                Vector2 cohesion_force   = Vector2Zero();
-                Vector2 separation_force = Vector2Zero();
+            if (rebuild)
+            {
+                build_verlet_lists(grid_data);
+            }
 
-                if (cohesion_boids_count > 0)
+            const int owners_count = static_cast<int>(verlet_owners.size());
+
+            jobs.parallel_for(owners_count, grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
                 {
-                    local_cohesion_center   = Vector2Scale(local_cohesion_center, 1.0f / cohesion_boids_count);
-                    local_cohesion_velocity = Vector2Scale(local_cohesion_velocity, 1.0f / cohesion_boids_count);
+                    const Vector2 position = verlet_positions[i];
+                    const view_cone cone   = vision(verlet_directions[i]);
+
+                    neighbor_sums sums;
+
+                    if (skips_steering(verlet_owners[i]))
+                    {
+                        steer(verlet_owners[i], sums, delta_time);
+                        continue;
+                    }
+
+                    // the lists are built all around, the heading changes every frame
+                    for (int n = verlet_start[i]; n < verlet_start[i + 1]; n++)
+                    {
+                        const int j = verlet_neighbors[n];
+
+                        steering_neighbor neighbor;
+                        neighbor.position = grid_data.nearest_image(position, verlet_positions[j]);
+                        if (!cone.contains(Vector2Subtract(neighbor.position, position)))
+                            continue;
+
+                        neighbor.velocity         = verlet_velocities[j];
+                        neighbor.distance_squared = Vector2DistanceSqr(neighbor.position, position);
 
-                    cohesion_force = Vector2Scale(Vector2Normalize(Vector2Subtract(local_cohesion_center, transform_data.position)), 30);
+                        if (neighbor.distance_squared < separation_radius * separation_radius)
+                        {
+                            pipeline.accumulate_near(sums, neighbor);
+                        }
+
+                        if (neighbor.distance_squared < cohesion_radius * cohesion_radius)
+                        {
+                            pipeline.accumulate(sums, neighbor);
+                        }
+                    }
+
+                    steer(verlet_owners[i], sums, delta_time);
                 }
-                local_cohesion_velocity = Vector2Normalize(local_cohesion_velocity);
+            });
+
+            return rebuild;
+        }
+
+        // Queries the grid for every boid with the skin added to the radius. The grid has to be hashed from the
+        // current positions. Also records the candidates it tested for the grid tuner.
+        void build_verlet_lists(grid& grid_data)
+        {
+            auto boids_view = registry.view<transform, movement, boid>();
+
+            verlet_owners.assign(boids_view.begin(), boids_view.end());
+
+            const int owners_count = static_cast<int>(verlet_owners.size());
+            const int chunks       = job_system::chunk_count(owners_count, grain_size);
+
+            verlet_positions.resize(owners_count);
+            verlet_velocities.resize(owners_count);
+            verlet_directions.resize(owners_count);
+            verlet_reference.resize(owners_count);
+
+            // neighbors are stored as owner indices
+            std::size_t max_entity = 0;
+            for (auto entity : verlet_owners)
+                max_entity = std::max<std::size_t>(max_entity, entt::to_entity(entity));
+
+            verlet_owner_index.assign(max_entity + 1, -1);
+            for (int i = 0; i < owners_count; i++)
+            {
+                verlet_owner_index[entt::to_entity(verlet_owners[i])] = i;
+
+                verlet_positions[i]  = boids_view.get<transform>(verlet_owners[i]).position;
+                verlet_velocities[i] = boids_view.get<movement>(verlet_owners[i]).old_velocity;
+                verlet_directions[i] = boids_view.get<transform>(verlet_owners[i]).direction;
+                verlet_reference[i]  = verlet_positions[i];
+            }
+
+            const float list_radius  = cohesion_radius + verlet_skin;
+            const auto& list_stencil = grid_data.get_stencil(list_radius);
+
+            std::vector<long long> chunk_candidates(chunks, 0);
+
+            verlet_chunk_neighbors.resize(chunks);
+            verlet_counts.resize(owners_count);
 
-                if (separation_boids_count > 0)
+            jobs.parallel_for(owners_count, grain_size, [&](int chunk, int first, int last) {
+                auto& neighbors = verlet_chunk_neighbors[chunk];
+                neighbors.clear();
+
+                for (int i = first; i < last; i++)
                 {
-                    local_sepation_center = Vector2Scale(local_sepation_center, 1.0f / separation_boids_count);
+                    const Vector2 position = verlet_positions[i];
+                    const auto before      = neighbors.size();
+
+                    grid_data.for_each_neighbor(position, list_radius, list_stencil, [&](entt::entity close_boid) {
+                        const auto index = entt::to_entity(close_boid);
+                        const int j      = index < verlet_owner_index.size() ? verlet_owner_index[index] : -1;
+                        if (j == -1 || j == i)
+                            return;
+
+                        chunk_candidates[chunk]++;
 
-                    separation_force = Vector2Scale(Vector2Normalize(Vector2Subtract(transform_data.position, local_sepation_center)), 60);
+                        const Vector2 close_boid_position = grid_data.nearest_image(position, verlet_positions[j]);
+                        if (Vector2DistanceSqr(close_boid_position, position) < list_radius * list_radius)
+                            neighbors.push_back(j);
+                    });
+
+                    verlet_counts[i] = static_cast<int>(neighbors.size() - before);
                 }
+            });
 
-                Vector2 temp             = Vector2Subtract(target_pos, transform_data.position);
-                float distance_to_target = Vector2Length(temp);
-                float target_scale       = std::clamp(distance_to_target, 0.0f, cohesion_radius) * 5.0f / cohesion_radius;
+            verlet_start.resize(owners_count + 1);
+            verlet_start[0] = 0;
+            for (int i = 0; i < owners_count; i++)
+                verlet_start[i + 1] = verlet_start[i] + verlet_counts[i];
 
-                Vector2 target_force = Vector2Scale(temp, target_scale / distance_to_target);
+            // the chunks cover the owners in order, so their lists concatenate into the CSR layout
+            verlet_neighbors.clear();
+            verlet_neighbors.reserve(verlet_start[owners_count]);
+            for (const auto& neighbors : verlet_chunk_neighbors)
+                verlet_neighbors.insert(verlet_neighbors.end(), neighbors.begin(), neighbors.end());
 
-                // Vector2 alignment_force = Vector2Scale(Vector2Normalize(Vector2Subtract(local_flock_direction, Vector2Normalize(movement_data.velocity))), 50);
-                Vector2 alignment_force = Vector2Scale(local_cohesion_velocity, 15);
+            grid_data.candidate_count = std::accumulate(chunk_candidates.begin(), chunk_candidates.end(), 0LL);
+            grid_data.query_count     = steering_updates;
+        }
 
-                Vector2 total_force = Vector2Add(alignment_force, separation_force);
-                total_force         = Vector2Add(total_force, cohesion_force);
-                total_force         = Vector2Add(total_force, target_force);
+        // Tests every unordered pair once: pairs inside a cell, plus pairs against the cells of the half
+        // stencil (offsets after (0, 0) in row order). Both sides of a pair are accumulated, into a buffer
+        // private to the chunk of cells being walked, and the buffers are summed per boid afterwards.
+        // Boids are indexed like grid::state. Returns the number of pairs tested.
+        long long update_pairs(grid& grid_data, delta_type delta_time)
+        {
+            const auto& entries     = grid_data.cell_entries;
+            const int entries_count = static_cast<int>(entries.size());
 
-                // add random noise to the total force
-                float x = GetRandomValue(-100, 100) * (5 / 100.0f);
-                float y = GetRandomValue(-100, 100) * (5 / 100.0f);
+            half_stencil.clear();
+            for (const auto& [dx, dy] : grid_data.get_stencil(cohesion_radius))
+            {
+                if (dy > 0 || (dy == 0 && dx > 0))
+                    half_stencil.emplace_back(dx, dy);
+            }
 
-                total_force = Vector2Add(total_force, Vector2{x, y});
+            occupied_cells.clear();
+            grid_data.for_each_occupied_cell([&](int cell_id) { occupied_cells.push_back(cell_id); });
 
-                movement_data.velocity = Vector2Add(movement_data.old_velocity, Vector2Scale(total_force, delta_time / 1000.0f));
+            const auto& state = grid_data.state;
 
-                //---------------------------------------------
-                if (debug_boid_id == boid_data.id)
-                {
-                    DrawCircleLinesV(transform_data.position, separation_radius, ColorAlpha(GREEN, 0.6f));
-                    DrawCircleLinesV(transform_data.position, cohesion_radius, ColorAlpha(RED, 0.6f));
+            // a pair is only skipped when neither boid recomputes its steering this frame
+            skipped_entries.assign(entries_count, 0);
+            if (max_steering_period > 1)
+            {
+                jobs.parallel_for(entries_count, grain_size, [&](int, int first, int last) {
+                    for (int i = first; i < last; i++)
+                    {
+                        skipped_entries[i] = skips_steering(entries[i]);
+                    }
+                });
+            }
 
-                    auto grid_view   = registry.view<grid>();
-                    auto grid_entity = grid_view.front();
+            // every chunk holds sums for all the boids, so there is one chunk of cells per thread
+            const int cells_count = static_cast<int>(occupied_cells.size());
+            const int cells_grain = jobs.even_grain(cells_count);
+            const int chunks      = job_system::chunk_count(cells_count, cells_grain);
 
-                    if (grid_entity == entt::null)
+            chunk_sums.resize(chunks);
+            std::vector<long long> chunk_pairs(chunks, 0);
+
+            jobs.parallel_for(cells_count, cells_grain, [&](int chunk, int first_cell, int last_cell) {
+                auto& sums = chunk_sums[chunk];
+                sums.assign(entries_count, neighbor_sums{});
+
+                auto add_pair = [&](int i, int j) {
+                    if (skipped_entries[i] && skipped_entries[j])
+                        return;
+
+                    const Vector2 position_i = Vector2{state.pos_x[i], state.pos_y[i]};
+                    const Vector2 position_j = Vector2{state.pos_x[j], state.pos_y[j]};
+
+                    const Vector2 image_j = grid_data.nearest_image(position_i, position_j);
+                    const Vector2 offset  = Vector2Subtract(image_j, position_i);
+                    const Vector2 image_i = Vector2Subtract(position_j, offset);
+
+                    auto distance_squared = Vector2LengthSqr(offset);
+
+                    if (distance_squared >= cohesion_radius * cohesion_radius && distance_squared >= separation_radius * separation_radius)
                         return;
 
-                    auto& grid_data = registry.get<grid>(grid_entity);
+                    const steering_neighbor neighbor_of_i = {image_j, Vector2{state.vel_x[j], state.vel_y[j]}, distance_squared};
+                    const steering_neighbor neighbor_of_j = {image_i, Vector2{state.vel_x[i], state.vel_y[i]}, distance_squared};
+
+                    // vision isn't symmetric, each side of the pair checks its own cone
+                    const bool i_sees_j = vision(Vector2{state.dir_x[i], state.dir_y[i]}).contains(offset);
+                    const bool j_sees_i = vision(Vector2{state.dir_x[j], state.dir_y[j]}).contains(Vector2Negate(offset));
 
-                    for (auto id : close_cells)
+                    if (distance_squared < separation_radius * separation_radius)
                     {
-                        auto [x, y] = grid_data.cell_id_to_index(id);
+                        if (i_sees_j)
+                            pipeline.accumulate_near(sums[i], neighbor_of_i);
+                        if (j_sees_i)
+                            pipeline.accumulate_near(sums[j], neighbor_of_j);
+                    }
 
-                        Color color = !grid_data.is_cell_empty(id)
-                                          ? RED
-                                          : ColorAlpha(GRAY, 0.3f);
+                    if (distance_squared < cohesion_radius * cohesion_radius)
+                    {
+                        if (i_sees_j)
+                            pipeline.accumulate(sums[i], neighbor_of_i);
+                        if (j_sees_i)
+                            pipeline.accumulate(sums[j], neighbor_of_j);
+                    }
+                };
+
+                for (int c = first_cell; c < last_cell; c++)
+                {
+                    const int cell_id = occupied_cells[c];
+                    const int slot    = grid_data.cell_slot(cell_id);
+                    const int first   = grid_data.cell_start[slot];
+                    const int end     = first + grid_data.cell_length[slot];
 
-                        DrawRectangleLines(x * grid_data.cell_size, y * grid_data.cell_size,
-                                           grid_data.cell_size, grid_data.cell_size, color);
+                    for (int i = first; i < end; i++)
+                    {
+                        for (int j = i + 1; j < end; j++)
+                        {
+                            add_pair(i, j);
+                        }
+                    }
+                    chunk_pairs[chunk] += static_cast<long long>(end - first) * (end - first - 1) / 2;
+
+                    auto [x, y] = grid_data.cell_id_to_index(cell_id);
+                    for (const auto& [dx, dy] : half_stencil)
+                    {
+                        const int other_id = grid_data.index_to_cell_id(x + dx, y + dy);
+                        if (other_id == -1 || other_id == cell_id)
+                            continue;
+
+                        const int other_slot = grid_data.cell_slot(other_id);
+                        if (other_slot == -1)
+                            continue;
+
+                        const int other_first = grid_data.cell_start[other_slot];
+                        const int other_end   = other_first + grid_data.cell_length[other_slot];
+
+                        for (int i = first; i < end; i++)
+                        {
+                            for (int j = other_first; j < other_end; j++)
+                            {
+                                add_pair(i, j);
+                            }
+                        }
+                        chunk_pairs[chunk] += static_cast<long long>(end - first) * (other_end - other_first);
                     }
-                    // DrawCircleV(target_pos, 5, VIOLET);
-                    //
-                    DrawLineV(transform_data.position, Vector2Add(transform_data.position, alignment_force), BLUE);
-                    DrawLineV(transform_data.position, Vector2Add(transform_data.position, separation_force), GREEN);
-                    DrawLineV(transform_data.position, Vector2Add(transform_data.position, cohesion_force), RED);
-                    DrawLineV(transform_data.position, Vector2Add(transform_data.position, target_force), VIOLET);
-                    //
-                    DrawLineV(transform_data.position, Vector2Add(transform_data.position, total_force), BLACK);
                 }
-                //---------------------------------------------
-            };
+            });
 
-            std::for_each(std::execution::par, boids_view.begin(), boids_view.end(), parallel_func);
+            jobs.parallel_for(entries_count, grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    neighbor_sums sums = chunk_sums[0][i];
+                    for (int other = 1; other < chunks; other++)
+                    {
+                        pipeline.merge(sums, chunk_sums[other][i]);
+                    }
 
-            auto end      = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-            std::cout << "boid_algo_process took " << duration.count() << " microseconds" << std::endl;
+                    steer(entries[i], sums, delta_time);
+                }
+            });
+
+            return std::accumulate(chunk_pairs.begin(), chunk_pairs.end(), 0LL);
+        }
+
+        // Temporal level of detail: a boid recomputes its steering every steering_periods[id] frames and reuses
+        // its last force in between, so the traversals skip its neighbors. The period comes from the last
+        // neighbor count and distance to the target, see steering_period_for, and the boids of a period are
+        // staggered over its frames by id so every frame recomputes about the same share of them.
+        void schedule_steering()
+        {
+            auto boids_view = registry.view<boid>();
+
+            if (max_steering_period <= 1)
+            {
+                steering_updates = static_cast<int>(boids_view.size());
+                return;
+            }
+
+            // a boid created since the last frame may have an id past every other one even if the count didn't
+            // change, so the arrays are checked against the largest id every frame
+            int max_id = -1;
+            for (auto entity : boids_view)
+                max_id = std::max(max_id, boids_view.get<boid>(entity).id);
+
+            if (max_id >= static_cast<int>(steering_periods.size()))
+            {
+                steering_forces.resize(max_id + 1, Vector2Zero());
+                steering_periods.resize(max_id + 1, 1);
+            }
+
+            steering_updates = 0;
+            for (auto entity : boids_view)
+                steering_updates += recomputes_steering(boids_view.get<boid>(entity).id);
+
+            std::cout << "boid_algo_process: steering " << steering_updates << " of " << boids_view.size() << " boids" << std::endl;
+        }
+
+        bool recomputes_steering(int id) const
+        {
+            return max_steering_period <= 1 || ((frame + static_cast<uint32_t>(id)) & (steering_periods[id] - 1)) == 0;
+        }
+
+        bool skips_steering(entt::entity entity) const
+        {
+            return max_steering_period > 1 && !recomputes_steering(registry.get<boid>(entity).id);
+        }
+
+        // crowded boids and the ones near the target recompute every frame, the period doubles every time the
+        // neighbor count halves below lod_crowd_neighbors
+        int steering_period_for(int neighbors, float target_distance_squared) const
+        {
+            if (target_distance_squared < lod_target_distance * lod_target_distance)
+                return 1;
+
+            int period = 1;
+            for (int crowd = lod_crowd_neighbors; neighbors < crowd && period < max_steering_period; crowd /= 2)
+                period *= 2;
+
+            return period;
+        }
+
+        // the vision cone of a boid heading along direction
+        view_cone vision(Vector2 direction) const
+        {
+            view_cone cone;
+            cone.direction      = Vector2Normalize(direction);
+            cone.cos_half_angle = vision_cos;
+            return cone;
+        }
+
+        // turns the gathered neighbor contributions into the new velocity of the boid
+        void steer(entt::entity entity, const neighbor_sums& sums, delta_type delta_time)
+        {
+            transform& transform_data = registry.get<transform>(entity);
+            movement& movement_data   = registry.get<movement>(entity);
+            boid& boid_data           = registry.get<boid>(entity);
+
+            steering_boid self;
+            self.position = transform_data.position;
+            self.velocity = movement_data.old_velocity;
+            self.target   = target_pos;
+            self.id       = static_cast<uint32_t>(boid_data.id);
+            self.frame    = frame;
+
+            const bool is_debug_boid = debug_draw_enabled && debug_boid_id == boid_data.id;
+
+            Vector2 total_force;
+            if (recomputes_steering(boid_data.id))
+            {
+                total_force = pipeline.finalize(sums, self, [&](Vector2 force, Color color) {
+                    if constexpr (debug_draw_enabled)
+                    {
+                        if (is_debug_boid)
+                            debug_draw_buffer::instance().line(transform_data.position, Vector2Add(transform_data.position, force), 1, color);
+                    }
+                });
+
+                if (max_steering_period > 1)
+                {
+                    steering_forces[boid_data.id]  = total_force;
+                    steering_periods[boid_data.id] = steering_period_for(pipeline.neighbor_count(sums), Vector2DistanceSqr(self.position, target_pos));
+                }
+            }
+            else
+            {
+                total_force = steering_forces[boid_data.id];
+            }
+
+            movement_data.velocity = Vector2Add(movement_data.old_velocity, Vector2Scale(total_force, delta_time / 1000.0f));
+
+            //---------------------------------------------
+            if constexpr (debug_draw_enabled)
+            {
+                if (!is_debug_boid)
+                    return;
+
+                auto& overlay = debug_draw_buffer::instance();
+
+                overlay.circle_lines(transform_data.position, separation_radius, ColorAlpha(GREEN, 0.6f));
+                overlay.circle_lines(transform_data.position, cohesion_radius, ColorAlpha(RED, 0.6f));
+
+                if (vision_cos > -1)
+                {
+                    const Vector2 heading = Vector2Scale(Vector2Normalize(transform_data.direction), cohesion_radius);
+                    overlay.line(transform_data.position, Vector2Add(transform_data.position, Vector2Rotate(heading, vision_half_angle)), 1, ORANGE);
+                    overlay.line(transform_data.position, Vector2Add(transform_data.position, Vector2Rotate(heading, -vision_half_angle)), 1, ORANGE);
+                }
+
+                auto grid_view   = registry.view<grid>();
+                auto grid_entity = grid_view.front();
+
+                if (grid_entity == entt::null)
+                    return;
+
+                auto& grid_data = registry.get<grid>(grid_entity);
+
+                auto close_cells = grid_data.get_close_cells(transform_data.position, cohesion_radius);
+
+                const float cell_size = static_cast<float>(grid_data.cell_size);
+
+                for (auto id : close_cells)
+                {
+                    auto [x, y] = grid_data.cell_id_to_index(id);
+
+                    Color color = !grid_data.is_cell_empty(id)
+                                      ? RED
+                                      : ColorAlpha(GRAY, 0.3f);
+
+                    overlay.rectangle_lines(Vector2{x * cell_size, y * cell_size}, Vector2{cell_size, cell_size}, color);
+                }
+                // DrawCircleV(target_pos, 5, VIOLET);
+                //
+                overlay.line(transform_data.position, Vector2Add(transform_data.position, total_force), 1, BLACK);
+            }
+            //---------------------------------------------
         }
 
-       protected:
         entt::registry& registry;
 
+        neighbor_traversal traversal;
+
+        // vision cone, vision_cos is the cosine of the half angle or -1 when boids see all around
+        float vision_half_angle;
+        float vision_cos;
+
+        float separation_radius = 30.0f;
+        float cohesion_radius   = 80.0f;
+        Vector2 target_pos      = Vector2{0, 0};
+
         int debug_boid_id = 0;
 
         int screen_width  = 0;
         int screen_height = 0;
+
+        // parallel loops run on the registry's job_system, in chunks of grain_size boids
+        job_system& jobs;
+        int grain_size = 256;
+        std::vector<entt::entity> boid_entities;
+
+        // scratch space of update_pairs
+        grid::stencil half_stencil;
+        std::vector<int> occupied_cells;
+        std::vector<std::vector<neighbor_sums>> chunk_sums;
+
+        // scratch space of update_streamed
+        std::vector<neighbor_sums> boid_sums;
+        grid::stencil near_stencil;
+        grid::stencil far_ring;
+
+        float far_field_radius;
+
+        int nearest_count;
+        float nearest_radius;
+
+        // verlet traversal: neighbors of owner i are verlet_neighbors[verlet_start[i], verlet_start[i + 1])
+        float verlet_skin = 16.0f;
+        std::vector<entt::entity> verlet_owners;
+        std::vector<int> verlet_owner_index;
+        std::vector<int> verlet_start;
+        std::vector<int> verlet_counts;
+        std::vector<int> verlet_neighbors;
+        std::vector<std::vector<int>> verlet_chunk_neighbors;
+        std::vector<Vector2> verlet_positions;
+        std::vector<Vector2> verlet_velocities;
+        std::vector<Vector2> verlet_directions;
+        std::vector<Vector2> verlet_reference;
+
+        // temporal level of detail, steering_forces and steering_periods are indexed by boid id
+        int max_steering_period;
+        int lod_crowd_neighbors   = 12;
+        float lod_target_distance = 150.0f;
+        std::vector<Vector2> steering_forces;
+        std::vector<int> steering_periods;
+        int steering_updates = 0; // boids recomputing this frame, the only ones that query the grid
+        std::vector<char> skipped_entries;
+
+        Pipeline pipeline;
+        uint32_t frame = 0;
+
+        simd_isa kernel_isa;
+        neighbor_kernel accumulate;
     };
 
+    using boid_algo_process  = basic_boid_algo_process<classic_rules>;
+    using free_flock_process = basic_boid_algo_process<free_flock_rules>;
+
 } // namespace boids
 
 #endif // BOIDS_HPP
@@ -5,14 +5,22 @@
 #include <raymath.h>
 #include <rlgl.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <entt/entt.hpp>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "base_definitions.hpp"
+#include "base_processors.hpp"
 #include "collision_definitions.hpp"
+#include "task_graph.hpp"
 
 namespace boids
 {
@@ -29,216 +37,1402 @@ namespace boids
         }
     };
 
+    // storage used for the grid cells, selected when the grid is created
+    enum class grid_backend
+    {
+        hash_map, // cell id -> set of boids, updated boid by boid
+        dense,    // flat offset arrays + contiguous boid array, rebuilt every frame
+        sparse,   // like dense, but only occupied cells get a slot in an open addressing table
+    };
+
+    // Sums over the boids of one cell, seen from afar the cell acts as count boids at position_sum / count
+    // moving at velocity_sum / count
+    struct cell_aggregate
+    {
+        Vector2 position_sum = Vector2{0, 0};
+        Vector2 velocity_sum = Vector2{0, 0};
+        int count            = 0;
+    };
+
+    // Field of view of a boid: the offsets within half_angle of direction (a unit vector), stored as the cosine
+    // of half_angle so no angle is computed per neighbor. cos_half_angle <= -1 sees all around.
+    struct view_cone
+    {
+        Vector2 direction    = Vector2{1, 0};
+        float cos_half_angle = -1;
+
+        bool sees_all() const
+        {
+            return cos_half_angle <= -1;
+        }
+
+        // offset . direction >= cos_half_angle * |offset|, squared so it needs no square root
+        bool contains(Vector2 offset) const
+        {
+            if (sees_all())
+                return true;
+
+            const float along = Vector2DotProduct(offset, direction);
+            const float bound = cos_half_angle * cos_half_angle * Vector2LengthSqr(offset);
+
+            return cos_half_angle >= 0 ? along >= 0 && along * along >= bound
+                                       : along >= 0 || along * along <= bound;
+        }
+
+        // whether the whole rect is out of view, false when unsure. A cone of at most 180 degrees sees
+        // nothing behind the boid, a wider one is blind in a convex cone, either way testing corners is enough.
+        bool hides(Vector2 origin, float left, float top, float right, float bottom) const
+        {
+            if (sees_all() || !std::isfinite(left) || !std::isfinite(top) || !std::isfinite(right) || !std::isfinite(bottom))
+                return false;
+
+            const Vector2 corners[4] = {Vector2{left, top}, Vector2{right, top}, Vector2{left, bottom}, Vector2{right, bottom}};
+            for (const auto& corner : corners)
+            {
+                const Vector2 offset = Vector2Subtract(corner, origin);
+                if (cos_half_angle >= 0 ? Vector2DotProduct(offset, direction) >= 0 : contains(offset))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    // Structure of arrays copy of the boid state for the flocking kernels. Boid i is grid::cell_entries[i],
+    // so the boids of a cell are contiguous, vel holds movement::old_velocity and dir the unit heading.
+    struct boid_state_block
+    {
+        std::vector<float> pos_x;
+        std::vector<float> pos_y;
+        std::vector<float> vel_x;
+        std::vector<float> vel_y;
+        std::vector<float> dir_x;
+        std::vector<float> dir_y;
+
+        int size() const
+        {
+            return static_cast<int>(pos_x.size());
+        }
+
+        void resize(int boids_count)
+        {
+            pos_x.resize(boids_count);
+            pos_y.resize(boids_count);
+            vel_x.resize(boids_count);
+            vel_y.resize(boids_count);
+            dir_x.resize(boids_count);
+            dir_y.resize(boids_count);
+        }
+    };
+
     struct grid
     {
         struct cell_data
         {
-            Vector2 local_boids_center;
-            Vector2 local_boids_direction;
+            Vector2 local_boids_center;
+            Vector2 local_boids_direction;
+
+            int boids_count;
+        };
+
+        // unbounded grids pack cell coordinates in [-2^14, 2^14) into 15 bits each, so ids stay positive
+        static constexpr int coord_bias = 1 << 14;
+
+        int cell_size;
+        int window_width; // extent of the grid, the window unless a world size is given, unused when unbounded
+        int window_height;
+        int columns;
+        int rows;
+        int cell_count;
+
+        world_bounds bounds;
+        grid_backend backend;
+
+        std::unordered_map<int, std::unordered_set<entt::entity>>
+            cell_to_boids;
+        std::unordered_map<int, cell_data> cell_data_map;
+
+        // boids that changed cell during the last hashing pass
+        int migration_count = 0;
+
+        // neighbor candidates tested and boids that queried during the last frame, filled by boid_algo_process.
+        // Boids whose steering is skipped by the temporal level of detail don't query and aren't counted
+        long long candidate_count = 0;
+        int query_count           = 0;
+
+        // frames served by the verlet neighbor lists of boid_algo_process, and how many of them rebuilt the lists
+        int neighbor_list_frames   = 0;
+        int neighbor_list_rebuilds = 0;
+
+        // dense backend: boids of cell i are cell_entries[cell_start[i], cell_start[i] + cell_length[i])
+        // sparse backend: same layout, indexed by the slot of the cell in slot_cell_id
+        std::vector<int> cell_start;
+        std::vector<int> cell_length;
+        std::vector<entt::entity> cell_entries;
+
+        // flat backends only, filled by boid_hashing_process after every rebuild
+        boid_state_block state;
+        std::vector<cell_aggregate> cell_aggregates; // indexed like cell_start
+        bool builds_cell_aggregates = false;         // set by the far_field traversal, the only reader
+
+        // sparse backend: open addressing (linear probing) table of cell ids, -1 marks a free slot
+        std::vector<int> slot_cell_id;
+        int slot_shift = 32;
+
+        // finer grids rebuilt by boid_hashing_process next to this one, for rules with a shorter reach
+        std::vector<grid> sub_levels;
+
+        // offsets (dx, dy) of the cells a radius query has to scan, cached per radius
+        using stencil = std::vector<std::pair<int, int>>;
+        std::map<float, stencil> stencil_cache;
+
+        // scratch space of the rebuilds
+        std::vector<int> entry_cells;
+        std::vector<std::vector<int>> chunk_offsets;
+
+        grid(int cell_size, grid_backend backend = grid_backend::hash_map) :
+            grid(cell_size, GetScreenWidth(), GetScreenHeight(), world_bounds::screen, backend)
+        {
+        }
+
+        // Grid over a world of the given size, not tied to the window. Toroidal worlds are rounded up to a
+        // whole number of cells and must be wider than the query stencils. Unbounded grids ignore the size
+        // and always use the sparse backend, since their cell ids can't index a flat array.
+        grid(int cell_size, int world_width, int world_height, world_bounds bounds,
+             grid_backend backend = grid_backend::sparse) :
+            cell_size(cell_size),
+            bounds(bounds),
+            backend(backend)
+        {
+            if (bounds == world_bounds::toroidal)
+            {
+                world_width  = (world_width + cell_size - 1) / cell_size * cell_size;
+                world_height = (world_height + cell_size - 1) / cell_size * cell_size;
+            }
+
+            if (bounds == world_bounds::unbounded)
+            {
+                world_width  = 0;
+                world_height = 0;
+                this->backend = grid_backend::sparse;
+            }
+
+            window_width  = world_width;
+            window_height = world_height;
+            columns       = window_width / cell_size;
+            rows          = window_height / cell_size;
+            cell_count    = columns * rows;
+            cell_to_boids = std::unordered_map<int, std::unordered_set<entt::entity>>();
+            cell_data_map = std::unordered_map<int, cell_data>();
+
+            if (this->backend == grid_backend::dense)
+            {
+                cell_start.assign(cell_count, 0);
+                cell_length.assign(cell_count, 0);
+            } else if (this->backend == grid_backend::sparse)
+            {
+                reset_slots(0);
+            }
+        }
+
+        // empty grid over the same world with another cell size, finer levels keep their ratio to it
+        grid resized(int new_cell_size) const
+        {
+            grid resized_grid(new_cell_size, window_width, window_height, bounds, backend);
+            resized_grid.builds_cell_aggregates = builds_cell_aggregates;
+            for (const auto& level : sub_levels)
+            {
+                resized_grid.add_level(std::max(1, level.cell_size * new_cell_size / cell_size));
+            }
+
+            return resized_grid;
+        }
+
+        void add_level(int level_cell_size)
+        {
+            sub_levels.emplace_back(level_cell_size, window_width, window_height, bounds,
+                                    backend == grid_backend::sparse ? grid_backend::sparse : grid_backend::dense);
+        }
+
+        // finest level whose cells are at least half the radius, so a query never needs more than 5x5 cells
+        grid& level_for_radius(float radius)
+        {
+            grid* level = this;
+            for (auto& sub_level : sub_levels)
+            {
+                if (sub_level.cell_size >= radius / 2 && sub_level.cell_size < level->cell_size)
+                    level = &sub_level;
+            }
+
+            return *level;
+        }
+
+        // cell coordinates of a position, clamped to the grid unless it wraps around
+        std::pair<int, int> position_to_index(Vector2 position) const
+        {
+            int cell_x = static_cast<int>(std::floor(position.x / cell_size));
+            int cell_y = static_cast<int>(std::floor(position.y / cell_size));
+
+            if (bounds == world_bounds::screen)
+            {
+                // boids sitting exactly on the right/bottom border would land outside the grid
+                cell_x = std::clamp(cell_x, 0, columns - 1);
+                cell_y = std::clamp(cell_y, 0, rows - 1);
+            } else if (bounds == world_bounds::unbounded)
+            {
+                cell_x = std::clamp(cell_x, -coord_bias, coord_bias - 1);
+                cell_y = std::clamp(cell_y, -coord_bias, coord_bias - 1);
+            }
+
+            return {cell_x, cell_y};
+        }
+
+        int hash_position(Vector2 position) const
+        {
+            auto [cell_x, cell_y] = position_to_index(position);
+
+            return index_to_cell_id(cell_x, cell_y); // 2D to 1D
+        }
+
+        // 2D index to grid cell id, wrapping around toroidal worlds, -1 if the cell is outside of the grid
+        int index_to_cell_id(int x, int y) const
+        {
+            if (bounds == world_bounds::unbounded)
+            {
+                if (x < -coord_bias || x >= coord_bias || y < -coord_bias || y >= coord_bias)
+                    return -1;
+
+                return (x + coord_bias) | ((y + coord_bias) << 15);
+            }
+
+            if (bounds == world_bounds::toroidal)
+            {
+                x = (x % columns + columns) % columns;
+                y = (y % rows + rows) % rows;
+            } else if (x < 0 || x >= columns || y < 0 || y >= rows)
+            {
+                return -1;
+            }
+
+            return x + y * columns;
+        }
+
+        // position of other as seen from origin, in toroidal worlds that is its closest periodic copy
+        Vector2 nearest_image(Vector2 origin, Vector2 other) const
+        {
+            if (bounds != world_bounds::toroidal)
+                return other;
+
+            const float width  = static_cast<float>(window_width);
+            const float height = static_cast<float>(window_height);
+
+            if (other.x - origin.x > width / 2)
+                other.x -= width;
+            else if (other.x - origin.x < -width / 2)
+                other.x += width;
+
+            if (other.y - origin.y > height / 2)
+                other.y -= height;
+            else if (other.y - origin.y < -height / 2)
+                other.y += height;
+
+            return other;
+        }
+
+        std::vector<int> get_close_cells(int cell_id)
+        {
+            const std::array<std::pair<int, int>, 8> NEIGHBORS = {std::make_pair(-1, -1),
+                                                                  std::make_pair(-1, 0),
+                                                                  std::make_pair(-1, 1),
+                                                                  std::make_pair(0, -1),
+                                                                  std::make_pair(0, 1),
+                                                                  std::make_pair(1, -1),
+                                                                  std::make_pair(1, 0),
+                                                                  std::make_pair(1, 1)};
+
+            auto ids    = std::vector<int>();
+            auto [x, y] = cell_id_to_index(cell_id);
+
+            for (const auto& coord : NEIGHBORS)
+            {
+                int id = index_to_cell_id(x + coord.first, y + coord.second);
+                if (id != -1)
+                {
+                    ids.push_back(id);
+                }
+            }
+
+            return ids;
+        }
+        // cells within radius of the position, pruned with the same rules as for_each_neighbor
+        std::vector<int> get_close_cells(Vector2 position, float radius)
+        {
+            auto ids = std::vector<int>();
+            for_each_stencil_cell(position, radius, get_stencil(radius), [&](int cell_id) {
+                ids.push_back(cell_id);
+            });
+
+            return ids;
+        }
+
+        // Offsets of every cell that has a point closer than radius to some point of the center cell, so the
+        // stencil is valid wherever the querying boid sits inside its cell. Corner cells are pruned by the
+        // distance between the cell rects rather than kept as part of a full square.
+        const stencil& get_stencil(float radius)
+        {
+            auto cached = stencil_cache.find(radius);
+            if (cached != stencil_cache.end())
+                return cached->second;
+
+            return stencil_cache.emplace(radius, make_stencil(radius, cell_size)).first->second;
+        }
+
+        // the cells a query of this radius visits on a grid with cells of cell_size, uncached
+        static stencil make_stencil(float radius, int cell_size)
+        {
+            const int reach = static_cast<int>(std::ceil(radius / cell_size));
+
+            stencil cells;
+            for (int dy = -reach; dy <= reach; dy++)
+            {
+                for (int dx = -reach; dx <= reach; dx++)
+                {
+                    float gap_x = std::max(std::abs(dx) - 1, 0) * static_cast<float>(cell_size);
+                    float gap_y = std::max(std::abs(dy) - 1, 0) * static_cast<float>(cell_size);
+
+                    if (gap_x * gap_x + gap_y * gap_y < radius * radius)
+                    {
+                        cells.emplace_back(dx, dy);
+                    }
+                }
+            }
+
+            return cells;
+        }
+
+        // grid cell id to 2D index
+        std::pair<int, int> cell_id_to_index(int cell_id) const
+        {
+            if (bounds == world_bounds::unbounded)
+                return {(cell_id & 0x7fff) - coord_bias, (cell_id >> 15) - coord_bias};
+
+            int x = cell_id % columns;
+            int y = cell_id / columns;
+
+            return {x, y};
+        }
+
+        // interleaves the bits of the cell coordinates (Z-order curve), so nearby cells get nearby codes
+        std::uint32_t morton_code(int cell_id) const
+        {
+            if (!is_valid_cell(cell_id))
+                return std::numeric_limits<std::uint32_t>::max();
+
+            auto spread_bits = [](std::uint32_t v) {
+                v &= 0x0000ffff;
+                v = (v | (v << 8)) & 0x00ff00ff;
+                v = (v | (v << 4)) & 0x0f0f0f0f;
+                v = (v | (v << 2)) & 0x33333333;
+                v = (v | (v << 1)) & 0x55555555;
+                return v;
+            };
+
+            auto [x, y] = cell_id_to_index(cell_id);
+            if (bounds == world_bounds::unbounded)
+            {
+                x += coord_bias;
+                y += coord_bias;
+            }
+
+            return spread_bits(x) | (spread_bits(y) << 1);
+        }
+
+        bool is_valid_cell(int cell_id) const
+        {
+            if (bounds == world_bounds::unbounded)
+                return cell_id >= 0;
+
+            return cell_id >= 0 && cell_id < cell_count;
+        }
+
+        // index of the cell in cell_start/cell_length for the flat backends, -1 if it has none
+        int cell_slot(int cell_id) const
+        {
+            if (!is_valid_cell(cell_id))
+                return -1;
+
+            if (backend == grid_backend::sparse)
+                return find_slot(cell_id);
+
+            return cell_id;
+        }
+
+        bool is_boid_in_cell(entt::entity entity, int cell_id)
+        {
+            if (backend != grid_backend::hash_map)
+            {
+                int slot = cell_slot(cell_id);
+                if (slot == -1)
+                    return false;
+
+                auto first = cell_entries.begin() + cell_start[slot];
+                auto last  = first + cell_length[slot];
+                return std::find(first, last, entity) != last;
+            }
+
+            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
+                return false;
+
+            return cell_to_boids[cell_id].find(entity) !=
+                   cell_to_boids[cell_id].end();
+        }
+
+        bool is_cell_empty(int cell_id)
+        {
+            if (backend != grid_backend::hash_map)
+            {
+                int slot = cell_slot(cell_id);
+                return slot == -1 || cell_length[slot] == 0;
+            }
+
+            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
+                return true;
+
+            return cell_to_boids[cell_id].size() == 0;
+        }
+
+        // NOTE: the dense and sparse backends are only filled through rebuild_cells, single boid updates are ignored
+        void add_boid_to_cell(entt::entity entity, int cell_id)
+        {
+            if (backend != grid_backend::hash_map)
+                return;
+
+            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
+            {
+                auto set               = std::unordered_set<entt::entity>();
+                cell_to_boids[cell_id] = set;
+            }
+
+            cell_to_boids[cell_id].insert(entity);
+        }
+
+        void remove_boid_from_cell(entt::entity entity, int cell_id)
+        {
+            if (backend != grid_backend::hash_map)
+                return;
+
+            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
+                return;
+
+            cell_to_boids[cell_id].erase(entity);
+        }
+
+        void get_boids_in_cell(int cell_id, std::unordered_set<entt::entity>& boids)
+        {
+            if (backend != grid_backend::hash_map)
+            {
+                int slot = cell_slot(cell_id);
+                if (slot == -1)
+                    return;
+
+                auto first = cell_entries.begin() + cell_start[slot];
+                boids      = std::unordered_set<entt::entity>(first, first + cell_length[slot]);
+                return;
+            }
+
+            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
+                return;
+
+            boids = cell_to_boids[cell_id];
+        }
+
+        // calls func(entity) for every boid in the cell, without copying the cell contents
+        template <typename Func>
+        void for_each_boid_in_cell(int cell_id, Func&& func) const
+        {
+            if (backend != grid_backend::hash_map)
+            {
+                int slot = cell_slot(cell_id);
+                if (slot == -1)
+                    return;
+
+                const int first = cell_start[slot];
+                const int last  = first + cell_length[slot];
+                for (int i = first; i < last; i++)
+                {
+                    func(cell_entries[i]);
+                }
+                return;
+            }
+
+            auto cell = cell_to_boids.find(cell_id);
+            if (cell == cell_to_boids.end())
+                return;
+
+            for (auto entity : cell->second)
+            {
+                func(entity);
+            }
+        }
+
+        // calls func(cell_id) for every cell holding at least one boid
+        template <typename Func>
+        void for_each_occupied_cell(Func&& func) const
+        {
+            if (backend == grid_backend::hash_map)
+            {
+                for (const auto& [cell_id, cell_boids] : cell_to_boids)
+                {
+                    if (!cell_boids.empty())
+                        func(cell_id);
+                }
+                return;
+            }
+
+            for (int slot = 0; slot < static_cast<int>(cell_length.size()); slot++)
+            {
+                if (cell_length[slot] > 0)
+                    func(backend == grid_backend::sparse ? slot_cell_id[slot] : slot);
+            }
+        }
+
+        // calls func(entity) for every boid in the (2 * cell_radius + 1)^2 block of cells centered on cell_id
+        template <typename Func>
+        void for_each_neighbor(int cell_id, int cell_radius, Func&& func) const
+        {
+            if (!is_valid_cell(cell_id))
+                return;
+
+            auto [x, y] = cell_id_to_index(cell_id);
+
+            for (int ny = y - cell_radius; ny <= y + cell_radius; ny++)
+            {
+                for (int nx = x - cell_radius; nx <= x + cell_radius; nx++)
+                {
+                    int id = index_to_cell_id(nx, ny);
+                    if (id != -1)
+                        for_each_boid_in_cell(id, func);
+                }
+            }
+        }
+
+        // calls func(entity) for every boid in the stencil cells around position, skipping cells that lie
+        // entirely outside the query circle. The stencil must come from get_stencil(radius).
+        template <typename Func>
+        void for_each_neighbor(Vector2 position, float radius, const stencil& cells, Func&& func, const view_cone& cone = view_cone{}) const
+        {
+            for_each_stencil_cell(position, radius, cells, [&](int cell_id) {
+                for_each_boid_in_cell(cell_id, func);
+            }, cone);
+        }
+
+        // flat backends only: calls func(first, last) with the range of cell_entries (and state) of every
+        // stencil cell around position, pruned like for_each_neighbor
+        template <typename Func>
+        void for_each_neighbor_range(Vector2 position, float radius, const stencil& cells, Func&& func, const view_cone& cone = view_cone{}) const
+        {
+            for_each_stencil_cell(position, radius, cells, [&](int cell_id) {
+                int slot = cell_slot(cell_id);
+                if (slot != -1 && cell_length[slot] > 0)
+                    func(cell_start[slot], cell_start[slot] + cell_length[slot]);
+            }, cone);
+        }
+
+        // cells out of the radius, or entirely out of the cone, are skipped
+        template <typename Func>
+        void for_each_stencil_cell(Vector2 position, float radius, const stencil& cells, Func&& cell_func, const view_cone& cone = view_cone{}) const
+        {
+            // border cells of a screen grid also hold the boids hashed from outside the window, so they are open
+            // towards it. Toroidal indices are left unwrapped here so the cell rects stay next to the position.
+            const bool open_borders = bounds == world_bounds::screen;
+            const float infinity    = std::numeric_limits<float>::infinity();
+
+            auto [x, y] = position_to_index(position);
+
+            for (const auto& [dx, dy] : cells)
+            {
+                int nx = x + dx;
+                int ny = y + dy;
+
+                int cell_id = index_to_cell_id(nx, ny);
+                if (cell_id == -1)
+                    continue;
+
+                // distance from the position to the closest point of the cell
+                float left   = open_borders && nx == 0 ? -infinity : static_cast<float>(nx * cell_size);
+                float right  = open_borders && nx == columns - 1 ? infinity : static_cast<float>((nx + 1) * cell_size);
+                float top    = open_borders && ny == 0 ? -infinity : static_cast<float>(ny * cell_size);
+                float bottom = open_borders && ny == rows - 1 ? infinity : static_cast<float>((ny + 1) * cell_size);
+
+                float gap_x = std::max({left - position.x, position.x - right, 0.0f});
+                float gap_y = std::max({top - position.y, position.y - bottom, 0.0f});
+
+                if ((dx != 0 || dy != 0) && gap_x * gap_x + gap_y * gap_y >= radius * radius)
+                    continue;
+
+                if (cone.hides(position, left, top, right, bottom))
+                    continue;
+
+                cell_func(cell_id);
+            }
+        }
+
+        // parallel counting sort: every chunk hashes its boids and builds its own histogram, a prefix sum over
+        // (cell, chunk) gives each chunk a private write range per cell, and the chunks scatter concurrently.
+        // Boids keep their input order inside a cell, so the result matches rebuild_cells for any chunking.
+        // Histograms are as large as the grid, so there is one chunk per thread of the job system.
+        // The sparse backend only hashes in parallel, its slot table is filled on a single thread.
+        // hash_boid is called exactly once per boid, so it may also update the boid.
+        template <typename HashFunc>
+        void rebuild_cells_parallel(const std::vector<entt::entity>& entities, job_system& jobs, HashFunc&& hash_boid)
+        {
+            const int boids_count = static_cast<int>(entities.size());
+            const int chunk_size  = jobs.even_grain(boids_count);
+            const int chunk_count = job_system::chunk_count(boids_count, chunk_size);
+
+            entry_cells.resize(boids_count);
+            chunk_offsets.resize(chunk_count);
+
+            if (backend == grid_backend::sparse)
+            {
+                jobs.parallel_for(boids_count, chunk_size, [&](int, int first, int last) {
+                    for (int i = first; i < last; i++)
+                    {
+                        entry_cells[i] = hash_boid(entities[i]);
+                    }
+                });
+
+                sort_entries(boids_count, [&](int i) { return entities[i]; });
+                return;
+            }
+
+            jobs.parallel_for(boids_count, chunk_size, [&](int chunk, int first, int last) {
+                auto& histogram = chunk_offsets[chunk];
+                histogram.assign(cell_count, 0);
+
+                for (int i = first; i < last; i++)
+                {
+                    entry_cells[i] = hash_boid(entities[i]);
+                    histogram[entry_cells[i]]++;
+                }
+            });
+
+            int offset = 0;
+            for (int cell_id = 0; cell_id < cell_count; cell_id++)
+            {
+                cell_start[cell_id] = offset;
+                for (int chunk = 0; chunk < chunk_count; chunk++)
+                {
+                    int count                     = chunk_offsets[chunk][cell_id];
+                    chunk_offsets[chunk][cell_id] = offset;
+                    offset += count;
+                }
+                cell_length[cell_id] = offset - cell_start[cell_id];
+            }
+
+            cell_entries.resize(boids_count);
+
+            jobs.parallel_for(boids_count, chunk_size, [&](int chunk, int first, int last) {
+                auto& cursor = chunk_offsets[chunk];
+
+                for (int i = first; i < last; i++)
+                {
+                    cell_entries[cursor[entry_cells[i]]++] = entities[i];
+                }
+            });
+        }
+
+        // counting sort of (boid, cell id) pairs into the flat arrays, boids keep their input order inside a cell
+        void rebuild_cells(const std::vector<std::pair<entt::entity, int>>& entries)
+        {
+            const int entries_count = static_cast<int>(entries.size());
+
+            entry_cells.resize(entries_count);
+            for (int i = 0; i < entries_count; i++)
+            {
+                entry_cells[i] = entries[i].second;
+            }
+
+            sort_entries(entries_count, [&](int i) { return entries[i].first; });
+        }
+
+        void update_cell_data(int cell_id, Vector2 position, Vector2 direction, int n_boids)
+        {
+            cell_data_map[cell_id].local_boids_center    = position;
+            cell_data_map[cell_id].local_boids_direction = direction;
+            cell_data_map[cell_id].boids_count           = n_boids;
+        }
+
+        cell_data get_cell_data(int cell_id)
+        {
+            if (cell_data_map.find(cell_id) == cell_data_map.end())
+                return cell_data{};
+
+            return cell_data_map[cell_id];
+        }
+
+       protected:
+        // serial counting sort of entity_at(i) into the cell entry_cells[i], entry_cells is overwritten with slots
+        template <typename EntityFunc>
+        void sort_entries(int entries_count, EntityFunc&& entity_at)
+        {
+            if (backend == grid_backend::sparse)
+                reset_slots(entries_count);
+
+            std::fill(cell_length.begin(), cell_length.end(), 0);
+
+            for (int i = 0; i < entries_count; i++)
+            {
+                entry_cells[i] = backend == grid_backend::sparse ? insert_slot(entry_cells[i]) : entry_cells[i];
+                cell_length[entry_cells[i]]++;
+            }
+
+            int offset = 0;
+            for (int slot = 0; slot < static_cast<int>(cell_length.size()); slot++)
+            {
+                cell_start[slot] = offset;
+                offset += cell_length[slot];
+            }
+
+            cell_entries.resize(entries_count);
+
+            std::vector<int> cursor = cell_start;
+            for (int i = 0; i < entries_count; i++)
+            {
+                cell_entries[cursor[entry_cells[i]]++] = entity_at(i);
+            }
+        }
+
+        // at most half of the slots are ever used, every boid can occupy its own cell
+        void reset_slots(int entries_count)
+        {
+            int bits = 4;
+            while ((1 << bits) < 2 * entries_count)
+            {
+                bits++;
+            }
+
+            slot_cell_id.assign(std::size_t(1) << bits, -1);
+            slot_shift = 32 - bits;
+
+            cell_start.assign(slot_cell_id.size(), 0);
+            cell_length.assign(slot_cell_id.size(), 0);
+        }
+
+        // fibonacci hashing, the top bits of the product are well mixed even for neighboring cell ids
+        int home_slot(int cell_id) const
+        {
+            return static_cast<int>((static_cast<std::uint32_t>(cell_id) * 2654435769u) >> slot_shift);
+        }
+
+        int insert_slot(int cell_id)
+        {
+            const int mask = static_cast<int>(slot_cell_id.size()) - 1;
+
+            for (int slot = home_slot(cell_id);; slot = (slot + 1) & mask)
+            {
+                if (slot_cell_id[slot] == cell_id)
+                    return slot;
+
+                if (slot_cell_id[slot] == -1)
+                {
+                    slot_cell_id[slot] = cell_id;
+                    return slot;
+                }
+            }
+        }
+
+        int find_slot(int cell_id) const
+        {
+            const int mask = static_cast<int>(slot_cell_id.size()) - 1;
+
+            for (int slot = home_slot(cell_id);; slot = (slot + 1) & mask)
+            {
+                if (slot_cell_id[slot] == cell_id)
+                    return slot;
+
+                if (slot_cell_id[slot] == -1)
+                    return -1;
+            }
+        }
+    };
+
+    struct collision_avoidance_process : entt::process<collision_avoidance_process, std::uint32_t>
+    {
+        using delta_type = std::uint32_t;
+
+        using reads  = component_list<transform, rect_collider>;
+        using writes = component_list<movement>;
+
+        collision_avoidance_process(entt::registry& registry) :
+            registry(registry) {}
+
+        void update(delta_type delta_time, void*)
+        {
+            auto boids_view = registry.view<transform, movement>();
+            for (auto [entity, transform_data, movement_data] : boids_view.each())
+            {
+                std::vector<RayCollision> hit_points;
+                if (raycast(registry, transform_data.position,
+                            transform_data.direction, hit_points, 75))
+                {
+                    RayCollision collision_point = hit_points[0];
+
+                    auto normal = collision_point.normal;
+                    auto v      = Vector3CrossProduct(normal, {0, 0, 1});
+
+                    auto dot = Vector3DotProduct(v, {transform_data.direction.x, transform_data.direction.y, 0});
+                    if (dot < 0)
+                    {
+                        v = Vector3Scale(v, -1);
+                    }
+
+                    Vector2 half_vector = Vector2Add(Vector2{normal.x, normal.y}, Vector2{v.x, v.y});
+                    half_vector         = Vector2Normalize(half_vector);
+
+                    float current_speed = Vector2Length(movement_data.velocity);
+                    current_speed       = current_speed <= 5.0f
+                                              ? 5.0f
+                                              : current_speed; // TODO: REMOVE HARDCODING
+
+                    Vector2 target_direction = Vector2Lerp(
+                        transform_data.direction,
+                        half_vector,
+                        delta_time * 0.0001f * 10);
+                    target_direction = Vector2Normalize(target_direction);
+
+                    movement_data.velocity =
+                        Vector2Scale(target_direction, current_speed);
+                }
+            }
+        }
+
+       protected:
+        entt::registry& registry;
+    };
+
+    // Picks the grid cell size from measured query costs. Every `sample_frames` frames the mean number of
+    // candidates per querying boid is compared with the last tuned value, and only once it drifted by more
+    // than `drift` the occupancy of the grid is used to predict the cost of other cell sizes:
+    //     cost(c) = scale * density * cells(c) * c^2 + cell_cost * cells(c)
+    // with cells(c) the size of the query stencil and density the boid weighted number of neighbors per px^2.
+    // scale calibrates the candidate term against the measured candidates at the current size, it absorbs
+    // what the occupancy can't see (the vision cone, boids near the edges). The grid is swapped only when the
+    // best size is predicted to be `hysteresis` cheaper than the current one. Runs before
+    // boid_hashing_process, which fills the new grid in the same frame.
+    struct grid_tuning_process : entt::process<grid_tuning_process, std::uint32_t>
+    {
+        using delta_type = std::uint32_t;
+
+        using reads  = component_list<>;
+        using writes = component_list<grid, boid>;
+
+        grid_tuning_process(entt::registry& registry, float query_radius = 80.0f, int sample_frames = 60) :
+            registry(registry),
+            query_radius(query_radius),
+            sample_frames(std::max(sample_frames, 1))
+        {
+        }
+
+        void update(delta_type delta_time, void*)
+        {
+            auto grid_view   = registry.view<grid>();
+            auto grid_entity = grid_view.front();
+
+            if (grid_entity == entt::null)
+                return;
+
+            auto& grid_data = registry.get<grid>(grid_entity);
+
+            cost_sum += static_cast<float>(grid_data.candidate_count) / std::max(grid_data.query_count, 1);
+            if (++sampled_frames < sample_frames)
+                return;
+
+            float measured_cost = cost_sum / sampled_frames;
+            cost_sum            = 0;
+            sampled_frames      = 0;
+
+            if (reference_cost > 0 && std::abs(measured_cost - reference_cost) < drift * reference_cost)
+                return;
+
+            reference_cost = measured_cost;
+
+            float density = boid_density(grid_data);
+            if (density <= 0 || measured_cost <= 0)
+                return;
+
+            const float scale = measured_cost / (density * visited_area(grid_data.cell_size));
+
+            int best_cell_size = grid_data.cell_size;
+            float current_cost = predicted_cost(grid_data.cell_size, scale * density);
+            float best_cost    = current_cost;
+
+            for (int cell_size = min_cell_size; cell_size <= max_cell_size; cell_size += cell_size_step)
+            {
+                // a toroidal world can only be split in whole cells without changing its size
+                if (grid_data.bounds == world_bounds::toroidal &&
+                    (grid_data.window_width % cell_size != 0 || grid_data.window_height % cell_size != 0))
+                    continue;
+
+                float cost = predicted_cost(cell_size, scale * density);
+                if (cost < best_cost)
+                {
+                    best_cost      = cost;
+                    best_cell_size = cell_size;
+                }
+            }
+
+            std::cout << "grid_tuning_process: " << measured_cost << " candidates per query, cell size "
+                      << grid_data.cell_size << " predicted " << current_cost << ", best " << best_cell_size
+                      << " predicted " << best_cost << std::endl;
+
+            if (best_cost > (1.0f - hysteresis) * current_cost)
+                return;
+
+            registry.replace<grid>(grid_entity, grid_data.resized(best_cell_size));
+
+            for (auto [entity, boid_data] : registry.view<boid>().each())
+            {
+                boid_data.current_cell_id = -1;
+            }
+
+            // the costs measured with the new size become the reference for the next drift
+            reference_cost = -1;
+        }
+
+       protected:
+        // neighbors per px^2 seen by the average boid, cells holding many boids weigh more
+        float boid_density(const grid& grid_data) const
+        {
+            long long boids_count   = 0;
+            long long squared_count = 0;
 
-            int boids_count;
-        };
+            grid_data.for_each_occupied_cell([&](int cell_id) {
+                long long cell_boids = 0;
+                grid_data.for_each_boid_in_cell(cell_id, [&](entt::entity) { cell_boids++; });
 
-        int cell_size;
-        int window_width;
-        int window_height;
-        int cell_count;
+                boids_count += cell_boids;
+                squared_count += cell_boids * cell_boids;
+            });
 
-        std::unordered_map<int, std::unordered_set<entt::entity>>
-            cell_to_boids;
-        std::unordered_map<int, cell_data> cell_data_map;
+            if (boids_count == 0)
+                return 0;
+
+            float cell_area = static_cast<float>(grid_data.cell_size) * grid_data.cell_size;
+            return static_cast<float>(squared_count) / (boids_count * cell_area);
+        }
 
-        grid(int cell_size) :
-            cell_size(cell_size)
+        // px^2 covered by the cells a query visits
+        float visited_area(int cell_size) const
         {
-            window_width  = GetScreenWidth();
-            window_height = GetScreenHeight();
-            cell_count    = (window_width / cell_size) * (window_height / cell_size);
-            cell_to_boids = std::unordered_map<int, std::unordered_set<entt::entity>>();
-            cell_data_map = std::unordered_map<int, cell_data>();
+            return static_cast<float>(grid::make_stencil(query_radius, cell_size).size()) * cell_size * cell_size;
+        }
+
+        float predicted_cost(int cell_size, float density) const
+        {
+            const float cells = static_cast<float>(grid::make_stencil(query_radius, cell_size).size());
+            return density * cells * cell_size * cell_size + cell_cost * cells;
         }
 
-        int hash_position(Vector2 position)
+        entt::registry& registry;
+
+        float query_radius;
+        int sample_frames;
+
+        int min_cell_size  = 10;
+        int max_cell_size  = 160;
+        int cell_size_step = 5;
+        float cell_cost    = 4.0f;  // cost of visiting a cell, in candidate tests
+        float drift        = 0.25f; // relative change of the measured cost that triggers a new estimate
+        float hysteresis   = 0.15f; // relative gain required before the grid is swapped
+
+        float cost_sum       = 0;
+        int sampled_frames   = 0;
+        float reference_cost = -1;
+    };
+
+    enum class hashing_mode
+    {
+        rebuild,          // rehash every boid and rewrite the whole grid
+        parallel_rebuild, // flat backends only: parallel counting sort, hash_map falls back to rebuild
+        incremental,      // hash_map only: boids that changed cell are moved, in one batched pass. The flat backends
+                          // keep every cell contiguous and can't be patched in place, they use parallel_rebuild
+    };
+
+    // asdasdadas asdada adsadas adasdasdad adasd
+    struct boid_hashing_process : entt::process<boid_hashing_process, std::uint32_t>
+    {
+        using delta_type = std::uint32_t;
+
+        using reads  = component_list<transform, movement>;
+        using writes = component_list<boid, grid>;
+
+        struct cell_move
         {
-            int x      = static_cast<int>(floor(position.x));
-            int y      = static_cast<int>(floor(position.y));
-            int cell_x = x / cell_size;
-            int cell_y = y / cell_size;
+            entt::entity entity;
+            int from_cell_id;
+            int to_cell_id;
+        };
 
-            return cell_x + cell_y * (window_width / cell_size); // 2D to 1D
+        boid_hashing_process(entt::registry& registry, hashing_mode mode = hashing_mode::rebuild) :
+            registry(registry),
+            mode(mode),
+            jobs(registry.ctx().emplace<job_system>())
+        {
         }
 
-        std::vector<int> get_close_cells(int cell_id)
+        void update(delta_type delta_time, void*)
         {
-            auto check_valid_cell = [&](int x, int y) {
-                if (x < 0 || x >= window_width / cell_size)
-                    return false;
+            auto start = std::chrono::high_resolution_clock::now();
 
-                if (y < 0 || y >= window_height / cell_size)
-                    return false;
+            auto boids_view  = registry.view<transform, movement, boid>();
+            auto grid_view   = registry.view<grid>();
+            auto grid_entity = grid_view.front();
 
-                return true;
-            };
+            if (grid_entity == entt::null)
+                return;
 
-            const std::array<std::pair<int, int>, 8> NEIGHBORS = {std::make_pair(-1, -1),
-                                                                  std::make_pair(-1, 0),
-                                                                  std::make_pair(-1, 1),
-                                                                  std::make_pair(0, -1),
-                                                                  std::make_pair(0, 1),
-                                                                  std::make_pair(1, -1),
-                                                                  std::make_pair(1, 0),
-                                                                  std::make_pair(1, 1)};
+            auto& grid_data = registry.get<grid>(grid_entity);
 
-            auto ids    = std::vector<int>();
-            auto [x, y] = cell_id_to_index(cell_id);
+            // collected once, the parallel rebuilds of this grid and of its finer levels share it
+            boid_entities.assign(boids_view.begin(), boids_view.end());
 
-            for (const auto& coord : NEIGHBORS)
+            if (grid_data.backend == grid_backend::hash_map && mode == hashing_mode::incremental)
+            {
+                update_incremental(grid_data);
+            } else if (grid_data.backend != grid_backend::hash_map && mode != hashing_mode::rebuild)
+            {
+                std::atomic<int> migrations = 0;
+
+                grid_data.rebuild_cells_parallel(boid_entities, jobs, [&](entt::entity entity) {
+                    auto [transform_data, boid_data] = boids_view.get<transform, boid>(entity);
+
+                    auto hash = grid_data.hash_position(transform_data.position);
+                    if (hash != boid_data.current_cell_id)
+                    {
+                        migrations.fetch_add(1, std::memory_order_relaxed);
+                        boid_data.current_cell_id = hash;
+                    }
+                    return hash;
+                });
+
+                grid_data.migration_count = migrations;
+            } else if (grid_data.backend != grid_backend::hash_map)
+            {
+                cell_entries.clear();
+                grid_data.migration_count = 0;
+
+                for (auto [entity, transform_data, movement_data, boid_data] :
+                     boids_view.each())
+                {
+                    auto hash = grid_data.hash_position(transform_data.position);
+
+                    cell_entries.emplace_back(entity, hash);
+                    grid_data.migration_count += hash != boid_data.current_cell_id;
+                    boid_data.current_cell_id = hash;
+                }
+
+                grid_data.rebuild_cells(cell_entries);
+            } else
             {
-                int nx = x + coord.first;
-                int ny = y + coord.second;
-                if (check_valid_cell(nx, ny))
+                grid_data.migration_count = 0;
+
+                for (auto [entity, transform_data, movement_data, boid_data] :
+                     boids_view.each())
                 {
-                    ids.push_back(nx + ny * (window_width / cell_size));
+                    auto hash = grid_data.hash_position(transform_data.position);
+
+                    if (boid_data.current_cell_id != -1)
+                    {
+                        grid_data.remove_boid_from_cell(entity, boid_data.current_cell_id);
+                    }
+                    grid_data.add_boid_to_cell(entity, hash);
+                    grid_data.migration_count += hash != boid_data.current_cell_id;
+                    boid_data.current_cell_id = hash;
                 }
             }
 
-            return ids;
-        }
-        // grid cell id to 2D index
-        std::pair<int, int> cell_id_to_index(int cell_id)
-        {
-            int x = cell_id % (window_width / cell_size);
-            int y = cell_id / (window_width / cell_size);
+            refresh_derived_data(grid_data, boid_entities);
 
-            return {x, y};
+            auto end      = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+            std::cout << "Boid Hashing: " << duration.count() << " microseconds, "
+                      << grid_data.migration_count << " migrations" << std::endl;
         }
 
-        bool is_boid_in_cell(entt::entity entity, int cell_id)
+        // fills the finer levels, the SoA block and the cell aggregates from the boids' current cells,
+        // entities are all the boids in the order the grid was rebuilt from
+        void refresh_derived_data(grid& grid_data, const std::vector<entt::entity>& entities)
         {
-            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
-                return false;
+            rebuild_sub_levels(grid_data, entities);
 
-            return cell_to_boids[cell_id].find(entity) !=
-                   cell_to_boids[cell_id].end();
+            if (grid_data.backend != grid_backend::hash_map)
+            {
+                fill_state_block(grid_data);
+
+                if (grid_data.builds_cell_aggregates)
+                    fill_cell_aggregates(grid_data);
+            }
         }
 
-        bool is_cell_empty(int cell_id)
+       protected:
+        // the finer levels are always dense and rebuilt from scratch, they don't track per boid cell ids
+        void rebuild_sub_levels(grid& grid_data, const std::vector<entt::entity>& entities)
         {
-            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
-                return true;
+            if (grid_data.sub_levels.empty())
+                return;
 
-            return cell_to_boids[cell_id].size() == 0;
-        }
+            auto boids_view = registry.view<transform, movement, boid>();
 
-        void add_boid_to_cell(entt::entity entity, int cell_id)
-        {
-            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
+            for (auto& level : grid_data.sub_levels)
             {
-                auto set               = std::unordered_set<entt::entity>();
-                cell_to_boids[cell_id] = set;
+                level.rebuild_cells_parallel(entities, jobs, [&](entt::entity entity) {
+                    return level.hash_position(boids_view.get<transform>(entity).position);
+                });
             }
-
-            cell_to_boids[cell_id].insert(entity);
         }
 
-        void remove_boid_from_cell(entt::entity entity, int cell_id)
+        // copies positions, old velocities and headings into the SoA block, in cell_entries order
+        void fill_state_block(grid& grid_data)
         {
-            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
-                return;
+            auto boids_view = registry.view<transform, movement, boid>();
 
-            cell_to_boids[cell_id].erase(entity);
-        }
+            const auto& entries     = grid_data.cell_entries;
+            const int entries_count = static_cast<int>(entries.size());
 
-        void get_boids_in_cell(int cell_id, std::unordered_set<entt::entity>& boids)
-        {
-            if (cell_to_boids.find(cell_id) == cell_to_boids.end())
-                return;
+            auto& state = grid_data.state;
+            state.resize(entries_count);
 
-            boids = cell_to_boids[cell_id];
+            jobs.parallel_for(entries_count, grain_size, [&](int, int first, int last) {
+                for (int i = first; i < last; i++)
+                {
+                    auto [transform_data, movement_data] = boids_view.get<transform, movement>(entries[i]);
+
+                    const Vector2 direction = Vector2Normalize(transform_data.direction);
+
+                    state.pos_x[i] = transform_data.position.x;
+                    state.pos_y[i] = transform_data.position.y;
+                    state.vel_x[i] = movement_data.old_velocity.x;
+                    state.vel_y[i] = movement_data.old_velocity.y;
+                    state.dir_x[i] = direction.x;
+                    state.dir_y[i] = direction.y;
+                }
+            });
         }
 
-        void update_cell_data(int cell_id, Vector2 position, Vector2 direction, int n_boids)
+        // sums the state block over every cell, a cell's boids are contiguous so each slot is one linear pass
+        void fill_cell_aggregates(grid& grid_data)
         {
-            cell_data_map[cell_id].local_boids_center    = position;
-            cell_data_map[cell_id].local_boids_direction = direction;
-            cell_data_map[cell_id].boids_count           = n_boids;
+            const auto& state     = grid_data.state;
+            const int slots_count = static_cast<int>(grid_data.cell_start.size());
+
+            grid_data.cell_aggregates.resize(slots_count);
+
+            jobs.parallel_for(slots_count, grain_size, [&](int, int first_slot, int last_slot) {
+                for (int slot = first_slot; slot < last_slot; slot++)
+                {
+                    cell_aggregate aggregate;
+
+                    const int first = grid_data.cell_start[slot];
+                    const int end   = first + grid_data.cell_length[slot];
+                    for (int i = first; i < end; i++)
+                    {
+                        aggregate.position_sum = Vector2Add(aggregate.position_sum, Vector2{state.pos_x[i], state.pos_y[i]});
+                        aggregate.velocity_sum = Vector2Add(aggregate.velocity_sum, Vector2{state.vel_x[i], state.vel_y[i]});
+                    }
+                    aggregate.count = end - first;
+
+                    grid_data.cell_aggregates[slot] = aggregate;
+                }
+            });
         }
 
-        cell_data get_cell_data(int cell_id)
+        // hash_map backend only. Every chunk collects the boids whose cell changed into its own move list, the
+        // lists are then applied on a single thread in chunk order so the grid never sees concurrent writes.
+        void update_incremental(grid& grid_data)
         {
-            if (cell_data_map.find(cell_id) == cell_data_map.end())
-                return cell_data{};
+            auto boids_view = registry.view<transform, movement, boid>();
 
-            return cell_data_map[cell_id];
+            const int boids_count = static_cast<int>(boid_entities.size());
+
+            chunk_moves.resize(job_system::chunk_count(boids_count, grain_size));
+
+            jobs.parallel_for(boids_count, grain_size, [&](int chunk, int first, int last) {
+                auto& moves = chunk_moves[chunk];
+                moves.clear();
+
+                for (int i = first; i < last; i++)
+                {
+                    auto entity                      = boid_entities[i];
+                    auto [transform_data, boid_data] = boids_view.get<transform, boid>(entity);
+
+                    auto hash = grid_data.hash_position(transform_data.position);
+                    if (hash != boid_data.current_cell_id)
+                    {
+                        moves.push_back(cell_move{entity, boid_data.current_cell_id, hash});
+                    }
+                }
+            });
+
+            grid_data.migration_count = 0;
+
+            for (auto& moves : chunk_moves)
+            {
+                for (const auto& move : moves)
+                {
+                    if (move.from_cell_id != -1)
+                    {
+                        grid_data.remove_boid_from_cell(move.entity, move.from_cell_id);
+                    }
+                    grid_data.add_boid_to_cell(move.entity, move.to_cell_id);
+                    boids_view.get<boid>(move.entity).current_cell_id = move.to_cell_id;
+                }
+
+                grid_data.migration_count += static_cast<int>(moves.size());
+            }
         }
+
+        entt::registry& registry;
+
+        hashing_mode mode;
+
+        job_system& jobs;
+        int grain_size = 512;
+        std::vector<std::vector<cell_move>> chunk_moves;
+
+        // reused between frames to avoid reallocating the (boid, cell) list
+        std::vector<std::pair<entt::entity, int>> cell_entries;
+        std::vector<entt::entity> boid_entities;
     };
 
-    struct collision_avoidance_process : entt::process<collision_avoidance_process, std::uint32_t>
+    // Replaces movement_process, boids_constraints_process and the boid_hashing_process of the next frame with
+    // a single pass: every boid is integrated, constrained and hashed while the grid is rebuilt, so positions
+    // are streamed once instead of three times. The steps are the ones of the separate processes, the result is
+    // the same to the bit. Attach it after the flocking and grid_tuning_process, its grid is the one the next
+    // frame flocks over. The flat backends always rebuild in parallel, hash_map moves boids on a single thread.
+    struct fused_integration_process : entt::process<fused_integration_process, std::uint32_t>
     {
         using delta_type = std::uint32_t;
 
-        collision_avoidance_process(entt::registry& registry) :
-            registry(registry) {}
+        using reads  = component_list<>;
+        using writes = component_list<transform, movement, boid, grid>;
+
+        // toroidal worlds wrap at the size of the registry's grid
+        fused_integration_process(entt::registry& registry, world_bounds bounds = world_bounds::screen) :
+            registry(registry),
+            constraints(registry, bounds, grid_extent(registry).first, grid_extent(registry).second),
+            hashing(registry, hashing_mode::parallel_rebuild),
+            jobs(registry.ctx().emplace<job_system>())
+        {
+            // the flocking of the first frame runs before this process, so the grid is filled here once
+            hashing.update(0, nullptr);
+        }
 
         void update(delta_type delta_time, void*)
         {
-            auto boids_view = registry.view<transform, movement>();
-            for (auto [entity, transform_data, movement_data] : boids_view.each())
+            auto start = std::chrono::high_resolution_clock::now();
+
+            auto boids_view  = registry.view<transform, movement, boid>();
+            auto grid_view   = registry.view<grid>();
+            auto grid_entity = grid_view.front();
+
+            if (grid_entity == entt::null)
+                return;
+
+            auto& grid_data = registry.get<grid>(grid_entity);
+
+            auto integrate = [&](transform& transform_data, movement& movement_data) {
+                movement_process::move(transform_data, movement_data, delta_time);
+                constraints.constrain(transform_data, movement_data);
+                return grid_data.hash_position(transform_data.position);
+            };
+
+            boid_entities.assign(boids_view.begin(), boids_view.end());
+
+            if (grid_data.backend != grid_backend::hash_map)
             {
-                std::vector<RayCollision> hit_points;
-                if (raycast(registry, transform_data.position,
-                            transform_data.direction, hit_points, 75))
-                {
-                    RayCollision collision_point = hit_points[0];
+                std::atomic<int> migrations = 0;
 
-                    auto normal = collision_point.normal;
-                    auto v      = Vector3CrossProduct(normal, {0, 0, 1});
+                grid_data.rebuild_cells_parallel(boid_entities, jobs, [&](entt::entity entity) {
+                    auto [transform_data, movement_data, boid_data] = boids_view.get<transform, movement, boid>(entity);
 
-                    auto dot = Vector3DotProduct(v, {transform_data.direction.x, transform_data.direction.y, 0});
-                    if (dot < 0)
+                    auto hash = integrate(transform_data, movement_data);
+                    if (hash != boid_data.current_cell_id)
                     {
-                        v = Vector3Scale(v, -1);
+                        migrations.fetch_add(1, std::memory_order_relaxed);
+                        boid_data.current_cell_id = hash;
                     }
+                    return hash;
+                });
 
-                    Vector2 half_vector = Vector2Add(Vector2{normal.x, normal.y}, Vector2{v.x, v.y});
-                    half_vector         = Vector2Normalize(half_vector);
-
-                    float current_speed = Vector2Length(movement_data.velocity);
-                    current_speed       = current_speed <= 5.0f
-                                              ? 5.0f
-                                              : current_speed; // TODO: REMOVE HARDCODING
+                grid_data.migration_count = migrations;
+            } else
+            {
+                grid_data.migration_count = 0;
 
-                    Vector2 target_direction = Vector2Lerp(
-                        transform_data.direction,
-                        half_vector,
-                        delta_time * 0.0001f * 10);
-                    target_direction = Vector2Normalize(target_direction);
+                for (auto [entity, transform_data, movement_data, boid_data] : boids_view.each())
+                {
+                    auto hash = integrate(transform_data, movement_data);
 
-                    movement_data.velocity =
-                        Vector2Scale(target_direction, current_speed);
+                    if (boid_data.current_cell_id != -1)
+                    {
+                        grid_data.remove_boid_from_cell(entity, boid_data.current_cell_id);
+                    }
+                    grid_data.add_boid_to_cell(entity, hash);
+                    grid_data.migration_count += hash != boid_data.current_cell_id;
+                    boid_data.current_cell_id = hash;
                 }
             }
+
+            hashing.refresh_derived_data(grid_data, boid_entities);
+
+            auto end      = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+            std::cout << "fused_integration_process took " << duration.count() << " microseconds, "
+                      << grid_data.migration_count << " migrations" << std::endl;
         }
 
        protected:
+        static std::pair<int, int> grid_extent(entt::registry& registry)
+        {
+            auto grid_entity = registry.view<grid>().front();
+            if (grid_entity == entt::null)
+                return {0, 0};
+
+            const auto& grid_data = registry.get<grid>(grid_entity);
+            return {grid_data.window_width, grid_data.window_height};
+        }
+
         entt::registry& registry;
+
+        boids_constraints_process constraints;
+        boid_hashing_process hashing;
+
+        job_system& jobs;
+        std::vector<entt::entity> boid_entities;
     };
 
-    // asdasdadas asdada adsadas adasdasdad adasd
-    struct boid_hashing_process : entt::process<boid_hashing_process, std::uint32_t>
+    // Sorts the boid component pools by the Z-order of their cell every `frequency` frames, so boids sharing
+    // a cell are close in memory and the neighbor reads in boid_algo_process stop jumping around the pools.
+    struct boid_reorder_process : entt::process<boid_reorder_process, std::uint32_t>
     {
         using delta_type = std::uint32_t;
 
-        boid_hashing_process(entt::registry& registry) :
-            registry(registry)
+        using reads  = component_list<grid>;
+        using writes = component_list<transform, movement, boid, renderable>;
+
+        boid_reorder_process(entt::registry& registry, int frequency = 60) :
+            registry(registry),
+            frequency(std::max(frequency, 1))
         {
         }
 
         void update(delta_type delta_time, void*)
         {
+            if (frame_count++ % frequency != 0)
+                return;
+
             auto start = std::chrono::high_resolution_clock::now();
 
-            auto boids_view  = registry.view<transform, movement, boid>();
             auto grid_view   = registry.view<grid>();
             auto grid_entity = grid_view.front();
 
@@ -247,32 +1441,68 @@ namespace boids
 
             auto& grid_data = registry.get<grid>(grid_entity);
 
-            for (auto [entity, transform_data, movement_data, boid_data] :
-                 boids_view.each())
-            {
-                auto hash = grid_data.hash_position(transform_data.position);
+            float span_before = mean_cell_span(grid_data);
 
-                if (boid_data.current_cell_id != -1)
-                {
-                    grid_data.remove_boid_from_cell(entity, boid_data.current_cell_id);
-                }
-                grid_data.add_boid_to_cell(entity, hash);
-                boid_data.current_cell_id = hash;
-            }
+            registry.sort<boid>([&grid_data](const boid& lhs, const boid& rhs) {
+                auto lhs_code = grid_data.morton_code(lhs.current_cell_id);
+                auto rhs_code = grid_data.morton_code(rhs.current_cell_id);
+
+                return lhs_code < rhs_code || (lhs_code == rhs_code && lhs.id < rhs.id);
+            });
+            registry.sort<transform, boid>();
+            registry.sort<movement, boid>();
+            registry.sort<renderable, boid>();
+
+            float span_after = mean_cell_span(grid_data);
 
             auto end      = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-            std::cout << "Boid Hashing: " << duration.count() << " microseconds" << std::endl;
+            std::cout << "boid_reorder_process took " << duration.count() << " microseconds, mean cell span "
+                      << span_before << " -> " << span_after << std::endl;
         }
 
        protected:
+        // Average distance (in transform pool slots) covered by a cell, divided by its boid count. 1 means the
+        // boids of every cell are contiguous in memory. Used as a portable stand-in for cache miss counters.
+        float mean_cell_span(const grid& grid_data)
+        {
+            auto& transform_storage = registry.storage<transform>();
+
+            float span_sum     = 0;
+            int occupied_cells = 0;
+
+            grid_data.for_each_occupied_cell([&](int cell_id) {
+                std::size_t min_index = std::numeric_limits<std::size_t>::max();
+                std::size_t max_index = 0;
+                int boids_count       = 0;
+
+                grid_data.for_each_boid_in_cell(cell_id, [&](entt::entity entity) {
+                    auto index = transform_storage.index(entity);
+                    min_index  = std::min(min_index, index);
+                    max_index  = std::max(max_index, index);
+                    boids_count++;
+                });
+
+                span_sum += static_cast<float>(max_index - min_index + 1) / boids_count;
+                occupied_cells++;
+            });
+
+            return occupied_cells > 0 ? span_sum / occupied_cells : 0.0f;
+        }
+
         entt::registry& registry;
+
+        int frequency;
+        int frame_count = 0;
     };
 
     struct cell_renderer_process : entt::process<cell_renderer_process, std::uint32_t>
     {
         using delta_type = std::uint32_t;
 
+        using reads  = component_list<grid>;
+        using writes = component_list<render_target>;
+
         cell_renderer_process(entt::registry& registry) :
             registry(registry) {}
 
@@ -307,6 +1537,9 @@ namespace boids
     {
         using delta_type = std::uint32_t;
 
+        using reads  = component_list<transform, boid>;
+        using writes = component_list<grid>;
+
         cell_data_process(entt::registry& registry) :
             registry(registry) {}
 
@@ -324,25 +1557,22 @@ namespace boids
 
             for (int cell_id = 0; cell_id < grid_data.cell_count; cell_id++)
             {
-                auto [x, y] = grid_data.cell_id_to_index(cell_id);
-                std::unordered_set<entt::entity> grid_boids;
-                grid_data.get_boids_in_cell(cell_id, grid_boids);
-
                 Vector2 local_boids_center    = {0, 0};
                 Vector2 local_boids_direction = {0, 0};
+                int boids_count               = 0;
 
-                for (auto boid : grid_boids)
-                {
-                    auto [transform_data, movement_data] = boids_view.get<transform, movement>(boid);
+                grid_data.for_each_boid_in_cell(cell_id, [&](entt::entity boid) {
+                    auto& transform_data = boids_view.get<transform>(boid);
 
                     local_boids_center    = Vector2Add(local_boids_center, transform_data.position);
                     local_boids_direction = Vector2Add(local_boids_direction, transform_data.direction);
-                }
+                    boids_count++;
+                });
 
-                // local_boids_center    = Vector2Scale(local_boids_center, 1.0f / grid_boids.size());
-                // local_boids_direction = Vector2Scale(local_boids_direction, 1.0f / grid_boids.size());
+                // local_boids_center    = Vector2Scale(local_boids_center, 1.0f / boids_count);
+                // local_boids_direction = Vector2Scale(local_boids_direction, 1.0f / boids_count);
 
-                grid_data.update_cell_data(cell_id, local_boids_center, local_boids_direction, grid_boids.size());
+                grid_data.update_cell_data(cell_id, local_boids_center, local_boids_direction, boids_count);
             }
         }
 
@@ -0,0 +1,69 @@
+#ifndef COUNTER_RNG_HPP
+#define COUNTER_RNG_HPP
+
+#include <cstdint>
+
+namespace boids
+{
+    static const uint64_t default_seed = 100;
+
+    // Counter based random numbers (Widynski's "Squares"): every value is a pure function of the seed, the boid
+    // id, the frame and a stream index, so there is no shared state to race on and the values don't depend on
+    // which thread or in which order a boid is processed.
+    struct counter_rng
+    {
+        // streams of a single (id, frame) pair, every random value drawn for a boid in a frame has its own
+        static const uint32_t stream_count = 8;
+
+        uint64_t key;
+
+        explicit counter_rng(uint64_t seed = default_seed) :
+            key(make_key(seed))
+        {
+        }
+
+        // id has to be below 2^29
+        uint32_t bits(uint32_t id, uint32_t frame, uint32_t stream) const
+        {
+            const uint64_t counter = (static_cast<uint64_t>(frame) << 32) | (id * stream_count + stream);
+
+            uint64_t x = counter * key;
+            uint64_t y = x;
+            uint64_t z = y + key;
+
+            x = x * x + y;
+            x = (x >> 32) | (x << 32);
+            x = x * x + z;
+            x = (x >> 32) | (x << 32);
+            x = x * x + y;
+            x = (x >> 32) | (x << 32);
+
+            return static_cast<uint32_t>((x * x + z) >> 32);
+        }
+
+        // in [0, 1)
+        float uniform(uint32_t id, uint32_t frame, uint32_t stream) const
+        {
+            return (bits(id, frame, stream) >> 8) * (1.0f / 16777216.0f);
+        }
+
+        // in [min, max)
+        float uniform(uint32_t id, uint32_t frame, uint32_t stream, float min, float max) const
+        {
+            return min + uniform(id, frame, stream) * (max - min);
+        }
+
+       protected:
+        // splitmix64 of the seed, squares wants a key with well spread bits and the low bit set
+        static uint64_t make_key(uint64_t seed)
+        {
+            uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+            z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z          = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z          = z ^ (z >> 31);
+            return z | 1;
+        }
+    };
+} // namespace boids
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef DEBUG_DRAW_HPP
+#define DEBUG_DRAW_HPP
+
+#include <raylib.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Debug overlays are on in debug builds, define BOIDS_DEBUG_DRAW to 0 or 1 to override it
+#ifndef BOIDS_DEBUG_DRAW
+    #ifdef NDEBUG
+        #define BOIDS_DEBUG_DRAW 0
+    #else
+        #define BOIDS_DEBUG_DRAW 1
+    #endif
+#endif
+
+static constexpr bool debug_draw_enabled = BOIDS_DEBUG_DRAW != 0;
+
+struct debug_draw_command
+{
+    enum class shape
+    {
+        line,            // from -> to, value is the thickness
+        circle_lines,    // center at from, value is the radius
+        rectangle_lines, // corner at from, to is the size
+    };
+
+    shape type;
+    Vector2 from;
+    Vector2 to;
+    float value;
+    Color color;
+};
+
+// Simulation processes run on worker threads, where raylib can't be called. They record their overlays
+// here instead, every thread into its own list so appending takes no lock, and debug_draw_process
+// draws them on the main thread. In release builds every call is empty.
+struct debug_draw_buffer
+{
+    static debug_draw_buffer& instance()
+    {
+        static debug_draw_buffer buffer;
+        return buffer;
+    }
+
+    void line(Vector2 from, Vector2 to, float thickness, Color color)
+    {
+#if BOIDS_DEBUG_DRAW
+        local_commands().push_back({debug_draw_command::shape::line, from, to, thickness, color});
+#endif
+    }
+
+    void circle_lines(Vector2 center, float radius, Color color)
+    {
+#if BOIDS_DEBUG_DRAW
+        local_commands().push_back({debug_draw_command::shape::circle_lines, center, Vector2{0, 0}, radius, color});
+#endif
+    }
+
+    void rectangle_lines(Vector2 corner, Vector2 size, Color color)
+    {
+#if BOIDS_DEBUG_DRAW
+        local_commands().push_back({debug_draw_command::shape::rectangle_lines, corner, size, 0, color});
+#endif
+    }
+
+    // main thread only, while no simulation process is running
+    void flush()
+    {
+#if BOIDS_DEBUG_DRAW
+        std::lock_guard<std::mutex> lock(threads_mutex);
+
+        for (auto& commands : thread_commands)
+        {
+            for (const auto& command : *commands)
+            {
+                switch (command.type)
+                {
+                    case debug_draw_command::shape::line:
+                        DrawLineEx(command.from, command.to, command.value, command.color);
+                        break;
+                    case debug_draw_command::shape::circle_lines:
+                        DrawCircleLinesV(command.from, command.value, command.color);
+                        break;
+                    case debug_draw_command::shape::rectangle_lines:
+                        DrawRectangleLines(static_cast<int>(command.from.x), static_cast<int>(command.from.y),
+                                           static_cast<int>(command.to.x), static_cast<int>(command.to.y), command.color);
+                        break;
+                }
+            }
+            commands->clear();
+        }
+#endif
+    }
+
+   protected:
+#if BOIDS_DEBUG_DRAW
+    // the lock is only taken the first time a thread records something
+    std::vector<debug_draw_command>& local_commands()
+    {
+        thread_local std::vector<debug_draw_command>* commands = nullptr;
+
+        if (commands == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(threads_mutex);
+            thread_commands.push_back(std::make_unique<std::vector<debug_draw_command>>());
+            commands = thread_commands.back().get();
+        }
+
+        return *commands;
+    }
+
+    std::mutex threads_mutex;
+    std::vector<std::unique_ptr<std::vector<debug_draw_command>>> thread_commands;
+#endif
+};
+
+#endif
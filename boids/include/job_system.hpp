@@ -0,0 +1,231 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool shared by the simulation, it lives in the registry context:
+//     registry.ctx().emplace<job_system>(worker_count);
+// and processes pick it up with registry.ctx().emplace<job_system>(), which creates a default one if main didn't.
+// Every worker owns a deque: it pushes and pops its own jobs at the back and, once it runs dry, steals the oldest
+// job at the front of another deque. Threads that aren't workers share one extra deque. A thread waiting on a
+// parallel_for runs queued jobs meanwhile, so nested parallel_for calls can't deadlock.
+struct job_system
+{
+    using job = std::function<void()>;
+
+    static int default_worker_count()
+    {
+        return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+
+    explicit job_system(int worker_count = default_worker_count())
+    {
+        worker_count = std::max(worker_count, 0);
+
+        for (int i = 0; i <= worker_count; i++)
+        {
+            queues.push_back(std::make_unique<job_queue>());
+        }
+
+        for (int i = 0; i < worker_count; i++)
+        {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~job_system()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake_up.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    job_system(const job_system&)            = delete;
+    job_system& operator=(const job_system&) = delete;
+
+    // the workers plus the thread that waits on a parallel_for, which works too
+    int thread_count() const
+    {
+        return static_cast<int>(workers.size()) + 1;
+    }
+
+    // chunks a parallel_for over count items with this grain is cut into
+    static int chunk_count(int count, int grain)
+    {
+        grain = std::max(grain, 1);
+        return count <= 0 ? 0 : (count + grain - 1) / grain;
+    }
+
+    // the grain that gives every thread one chunk of count items, for chunks holding large private buffers
+    int even_grain(int count) const
+    {
+        return std::max(1, (count + thread_count() - 1) / thread_count());
+    }
+
+    void submit(job task)
+    {
+        auto& queue = *queues[local_queue_index()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(task));
+        }
+        queued_count.fetch_add(1, std::memory_order_release);
+
+        // taking the lock orders the notification after a worker checking queued_count went to sleep
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake_up.notify_one();
+    }
+
+    // runs one queued job on the calling thread, false when every deque is empty
+    bool run_one()
+    {
+        job task;
+        if (!take(task))
+            return false;
+
+        task();
+        return true;
+    }
+
+    // Calls func(chunk, first, last) for the chunks [first, last) of [0, count), grain items each but the last,
+    // and returns once all of them ran. Chunks are numbered in order from 0 to chunk_count(count, grain) - 1, so
+    // they can index private buffers.
+    template <typename Func>
+    void parallel_for(int count, int grain, Func&& func)
+    {
+        grain            = std::max(grain, 1);
+        const int chunks = chunk_count(count, grain);
+
+        if (chunks == 0)
+            return;
+
+        if (chunks == 1 || workers.empty())
+        {
+            for (int chunk = 0; chunk < chunks; chunk++)
+                func(chunk, chunk * grain, std::min(count, (chunk + 1) * grain));
+            return;
+        }
+
+        std::atomic<int> remaining = chunks - 1;
+
+        // pushed last to first so the caller pops them in order while thieves take the far end
+        for (int chunk = chunks - 1; chunk > 0; chunk--)
+        {
+            submit([&func, &remaining, chunk, grain, count] {
+                func(chunk, chunk * grain, std::min(count, (chunk + 1) * grain));
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+            });
+        }
+
+        func(0, 0, std::min(count, grain));
+
+        while (remaining.load(std::memory_order_acquire) > 0)
+        {
+            if (!run_one())
+                std::this_thread::yield();
+        }
+    }
+
+   protected:
+    struct job_queue
+    {
+        std::mutex mutex;
+        std::deque<job> jobs;
+    };
+
+    // the deque of the calling thread, the shared one for threads that aren't workers of this pool
+    int local_queue_index() const
+    {
+        return worker_owner() == this ? worker_index() : static_cast<int>(workers.size());
+    }
+
+    static const job_system*& worker_owner()
+    {
+        thread_local const job_system* owner = nullptr;
+        return owner;
+    }
+
+    static int& worker_index()
+    {
+        thread_local int index = -1;
+        return index;
+    }
+
+    // the newest job of the own deque, else the oldest job of the others
+    bool take(job& task)
+    {
+        if (queued_count.load(std::memory_order_acquire) == 0)
+            return false;
+
+        const int own         = local_queue_index();
+        const int queue_count = static_cast<int>(queues.size());
+
+        for (int offset = 0; offset < queue_count; offset++)
+        {
+            auto& queue = *queues[(own + offset) % queue_count];
+
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                continue;
+
+            if (offset == 0)
+            {
+                task = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            } else
+            {
+                task = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+            }
+
+            queued_count.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+
+        return false;
+    }
+
+    void work(int index)
+    {
+        worker_owner() = this;
+        worker_index() = index;
+
+        while (true)
+        {
+            if (run_one())
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake_up.wait(lock, [&] { return stopping || queued_count.load(std::memory_order_acquire) > 0; });
+
+            if (stopping)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<job_queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<int> queued_count = 0;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,522 @@
+#ifndef NEIGHBOR_KERNELS_HPP
+#define NEIGHBOR_KERNELS_HPP
+
+#include <boids_definitions.hpp>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define BOIDS_SIMD_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define BOIDS_TARGET(isa)
+    #else
+        #define BOIDS_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+namespace boids
+{
+    enum class simd_isa
+    {
+        automatic, // best one the cpu supports
+        scalar,
+        sse42,
+        avx2,
+        avx512,
+    };
+
+    static const char* simd_isa_name(simd_isa isa)
+    {
+        switch (isa)
+        {
+            case simd_isa::scalar:
+                return "scalar";
+            case simd_isa::sse42:
+                return "sse4.2";
+            case simd_isa::avx2:
+                return "avx2";
+            case simd_isa::avx512:
+                return "avx512";
+            default:
+                return "automatic";
+        }
+    }
+
+    // parses the names printed by simd_isa_name, anything else is automatic
+    static simd_isa simd_isa_from_name(const char* name)
+    {
+        for (auto isa : {simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512})
+        {
+            if (std::strcmp(name, simd_isa_name(isa)) == 0)
+                return isa;
+        }
+        return simd_isa::automatic;
+    }
+
+    static bool is_simd_isa_supported(simd_isa isa)
+    {
+        if (isa == simd_isa::scalar)
+            return true;
+
+#if defined(BOIDS_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        const bool sse42   = (info[2] & (1 << 20)) != 0;
+        const bool os_avx  = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+        const auto xcr0    = os_avx ? _xgetbv(0) : 0;
+        const bool ymm     = (xcr0 & 0x06) == 0x06;
+        const bool zmm     = (xcr0 & 0xe6) == 0xe6;
+        __cpuidex(info, 7, 0);
+        const bool avx2    = ymm && (info[1] & (1 << 5)) != 0;
+        const bool avx512f = zmm && (info[1] & (1 << 16)) != 0;
+
+        switch (isa)
+        {
+            case simd_isa::sse42:
+                return sse42;
+            case simd_isa::avx2:
+                return avx2;
+            case simd_isa::avx512:
+                return avx512f;
+            default:
+                return false;
+        }
+#elif defined(BOIDS_SIMD_X86)
+        // also checks that the os saves the wide registers
+        switch (isa)
+        {
+            case simd_isa::sse42:
+                return __builtin_cpu_supports("sse4.2");
+            case simd_isa::avx2:
+                return __builtin_cpu_supports("avx2");
+            case simd_isa::avx512:
+                return __builtin_cpu_supports("avx512f");
+            default:
+                return false;
+        }
+#else
+        return false;
+#endif
+    }
+
+    // A forced isa the cpu can't run falls back to the automatic choice.
+    static simd_isa resolve_simd_isa(simd_isa requested = simd_isa::automatic)
+    {
+        if (requested != simd_isa::automatic)
+        {
+            if (is_simd_isa_supported(requested))
+                return requested;
+
+            std::cout << "simd: " << simd_isa_name(requested) << " is not supported by this cpu" << std::endl;
+        }
+
+        for (auto isa : {simd_isa::avx512, simd_isa::avx2, simd_isa::sse42})
+        {
+            if (is_simd_isa_supported(isa))
+                return isa;
+        }
+        return simd_isa::scalar;
+    }
+
+    // Flocking sums of one boid, counts are kept as floats so every lane accumulates the same way
+    struct kernel_sums
+    {
+        float separation_count = 0;
+        float separation_x     = 0;
+        float separation_y     = 0;
+
+        float cohesion_count = 0;
+        float cohesion_x     = 0;
+        float cohesion_y     = 0;
+        float velocity_x     = 0;
+        float velocity_y     = 0;
+    };
+
+    struct kernel_query
+    {
+        float x;
+        float y;
+
+        float separation_radius_squared;
+        float cohesion_radius_squared;
+
+        // world size for the toroidal nearest image, 0 when the world doesn't wrap
+        float wrap_width;
+        float wrap_height;
+
+        // neighbors out of it are skipped, the default sees all around
+        view_cone cone;
+    };
+
+    // Accumulates the boids [first, last) of a state block into sums, the caller leaves the querying boid out
+    using neighbor_kernel = void (*)(const kernel_query& query, const boid_state_block& state, int first, int last, kernel_sums& sums);
+
+    namespace kernels
+    {
+        // same as grid::nearest_image, per axis
+        inline float wrap_coordinate(float origin, float other, float size)
+        {
+            if (size == 0)
+                return other;
+
+            if (other - origin > size / 2)
+                other -= size;
+            else if (other - origin < -size / 2)
+                other += size;
+
+            return other;
+        }
+
+        inline void accumulate_scalar(const kernel_query& query, const boid_state_block& state, int first, int last, kernel_sums& sums)
+        {
+            for (int j = first; j < last; j++)
+            {
+                const float x = wrap_coordinate(query.x, state.pos_x[j], query.wrap_width);
+                const float y = wrap_coordinate(query.y, state.pos_y[j], query.wrap_height);
+
+                const float dx = x - query.x;
+                const float dy = y - query.y;
+
+                const float distance_squared = dx * dx + dy * dy;
+
+                if (!query.cone.contains(Vector2{dx, dy}))
+                    continue;
+
+                if (distance_squared < query.separation_radius_squared)
+                {
+                    sums.separation_x += x;
+                    sums.separation_y += y;
+                    sums.separation_count++;
+                }
+
+                if (distance_squared < query.cohesion_radius_squared)
+                {
+                    sums.cohesion_x += x;
+                    sums.cohesion_y += y;
+                    sums.velocity_x += state.vel_x[j];
+                    sums.velocity_y += state.vel_y[j];
+                    sums.cohesion_count++;
+                }
+            }
+        }
+
+#ifdef BOIDS_SIMD_X86
+        // 4 lanes, the masks are and-ed with the values so the sums stay branch free
+        BOIDS_TARGET("sse4.2")
+        inline __m128 wrap_sse(__m128 origin, __m128 other, __m128 size, __m128 half_size)
+        {
+            const __m128 offset = _mm_sub_ps(other, origin);
+            const __m128 above  = _mm_and_ps(_mm_cmpgt_ps(offset, half_size), size);
+            const __m128 below  = _mm_and_ps(_mm_cmplt_ps(offset, _mm_sub_ps(_mm_setzero_ps(), half_size)), size);
+            return _mm_add_ps(_mm_sub_ps(other, above), below);
+        }
+
+        // all ones in the lanes inside the cone, same test as view_cone::contains
+        BOIDS_TARGET("sse4.2")
+        inline __m128 in_view_sse(__m128 dx, __m128 dy, __m128 distance_squared, const view_cone& cone)
+        {
+            const __m128 along = _mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(cone.direction.x)), _mm_mul_ps(dy, _mm_set1_ps(cone.direction.y)));
+            const __m128 along_sqr = _mm_mul_ps(along, along);
+            const __m128 bound     = _mm_mul_ps(_mm_set1_ps(cone.cos_half_angle * cone.cos_half_angle), distance_squared);
+            const __m128 ahead     = _mm_cmpge_ps(along, _mm_setzero_ps());
+
+            return cone.cos_half_angle >= 0 ? _mm_and_ps(ahead, _mm_cmpge_ps(along_sqr, bound))
+                                            : _mm_or_ps(ahead, _mm_cmple_ps(along_sqr, bound));
+        }
+
+        BOIDS_TARGET("sse4.2")
+        inline float horizontal_sum_sse(__m128 value)
+        {
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, value);
+            return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+
+        BOIDS_TARGET("sse4.2")
+        inline void accumulate_sse42(const kernel_query& query, const boid_state_block& state, int first, int last, kernel_sums& sums)
+        {
+            const __m128 query_x          = _mm_set1_ps(query.x);
+            const __m128 query_y          = _mm_set1_ps(query.y);
+            const __m128 separation_sqr   = _mm_set1_ps(query.separation_radius_squared);
+            const __m128 cohesion_sqr     = _mm_set1_ps(query.cohesion_radius_squared);
+            const __m128 wrap_width       = _mm_set1_ps(query.wrap_width);
+            const __m128 wrap_height      = _mm_set1_ps(query.wrap_height);
+            const __m128 half_wrap_width  = _mm_set1_ps(query.wrap_width / 2);
+            const __m128 half_wrap_height = _mm_set1_ps(query.wrap_height / 2);
+            const __m128 one              = _mm_set1_ps(1.0f);
+            const bool wraps              = query.wrap_width != 0;
+            const bool culls              = !query.cone.sees_all();
+
+            __m128 separation_count = _mm_setzero_ps(), separation_x = _mm_setzero_ps(), separation_y = _mm_setzero_ps();
+            __m128 cohesion_count = _mm_setzero_ps(), cohesion_x = _mm_setzero_ps(), cohesion_y = _mm_setzero_ps();
+            __m128 velocity_x = _mm_setzero_ps(), velocity_y = _mm_setzero_ps();
+
+            int j = first;
+            for (; j + 4 <= last; j += 4)
+            {
+                __m128 x = _mm_loadu_ps(&state.pos_x[j]);
+                __m128 y = _mm_loadu_ps(&state.pos_y[j]);
+
+                if (wraps)
+                {
+                    x = wrap_sse(query_x, x, wrap_width, half_wrap_width);
+                    y = wrap_sse(query_y, y, wrap_height, half_wrap_height);
+                }
+
+                const __m128 dx               = _mm_sub_ps(x, query_x);
+                const __m128 dy               = _mm_sub_ps(y, query_y);
+                const __m128 distance_squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+                __m128 is_separation = _mm_cmplt_ps(distance_squared, separation_sqr);
+                __m128 is_cohesion   = _mm_cmplt_ps(distance_squared, cohesion_sqr);
+
+                if (culls)
+                {
+                    const __m128 visible = in_view_sse(dx, dy, distance_squared, query.cone);
+                    is_separation        = _mm_and_ps(is_separation, visible);
+                    is_cohesion          = _mm_and_ps(is_cohesion, visible);
+                }
+
+                separation_count = _mm_add_ps(separation_count, _mm_and_ps(is_separation, one));
+                separation_x     = _mm_add_ps(separation_x, _mm_and_ps(is_separation, x));
+                separation_y     = _mm_add_ps(separation_y, _mm_and_ps(is_separation, y));
+
+                cohesion_count = _mm_add_ps(cohesion_count, _mm_and_ps(is_cohesion, one));
+                cohesion_x     = _mm_add_ps(cohesion_x, _mm_and_ps(is_cohesion, x));
+                cohesion_y     = _mm_add_ps(cohesion_y, _mm_and_ps(is_cohesion, y));
+                velocity_x     = _mm_add_ps(velocity_x, _mm_and_ps(is_cohesion, _mm_loadu_ps(&state.vel_x[j])));
+                velocity_y     = _mm_add_ps(velocity_y, _mm_and_ps(is_cohesion, _mm_loadu_ps(&state.vel_y[j])));
+            }
+
+            sums.separation_count += horizontal_sum_sse(separation_count);
+            sums.separation_x += horizontal_sum_sse(separation_x);
+            sums.separation_y += horizontal_sum_sse(separation_y);
+            sums.cohesion_count += horizontal_sum_sse(cohesion_count);
+            sums.cohesion_x += horizontal_sum_sse(cohesion_x);
+            sums.cohesion_y += horizontal_sum_sse(cohesion_y);
+            sums.velocity_x += horizontal_sum_sse(velocity_x);
+            sums.velocity_y += horizontal_sum_sse(velocity_y);
+
+            accumulate_scalar(query, state, j, last, sums);
+        }
+
+        // 8 lanes, same structure as the sse kernel
+        BOIDS_TARGET("avx2")
+        inline __m256 wrap_avx2(__m256 origin, __m256 other, __m256 size, __m256 half_size)
+        {
+            const __m256 offset = _mm256_sub_ps(other, origin);
+            const __m256 above  = _mm256_and_ps(_mm256_cmp_ps(offset, half_size, _CMP_GT_OQ), size);
+            const __m256 below  = _mm256_and_ps(_mm256_cmp_ps(offset, _mm256_sub_ps(_mm256_setzero_ps(), half_size), _CMP_LT_OQ), size);
+            return _mm256_add_ps(_mm256_sub_ps(other, above), below);
+        }
+
+        BOIDS_TARGET("avx2")
+        inline __m256 in_view_avx2(__m256 dx, __m256 dy, __m256 distance_squared, const view_cone& cone)
+        {
+            const __m256 along = _mm256_add_ps(_mm256_mul_ps(dx, _mm256_set1_ps(cone.direction.x)), _mm256_mul_ps(dy, _mm256_set1_ps(cone.direction.y)));
+            const __m256 along_sqr = _mm256_mul_ps(along, along);
+            const __m256 bound     = _mm256_mul_ps(_mm256_set1_ps(cone.cos_half_angle * cone.cos_half_angle), distance_squared);
+            const __m256 ahead     = _mm256_cmp_ps(along, _mm256_setzero_ps(), _CMP_GE_OQ);
+
+            return cone.cos_half_angle >= 0 ? _mm256_and_ps(ahead, _mm256_cmp_ps(along_sqr, bound, _CMP_GE_OQ))
+                                            : _mm256_or_ps(ahead, _mm256_cmp_ps(along_sqr, bound, _CMP_LE_OQ));
+        }
+
+        BOIDS_TARGET("avx2")
+        inline float horizontal_sum_avx2(__m256 value)
+        {
+            alignas(32) float lanes[8];
+            _mm256_store_ps(lanes, value);
+            return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+        }
+
+        BOIDS_TARGET("avx2")
+        inline void accumulate_avx2(const kernel_query& query, const boid_state_block& state, int first, int last, kernel_sums& sums)
+        {
+            const __m256 query_x          = _mm256_set1_ps(query.x);
+            const __m256 query_y          = _mm256_set1_ps(query.y);
+            const __m256 separation_sqr   = _mm256_set1_ps(query.separation_radius_squared);
+            const __m256 cohesion_sqr     = _mm256_set1_ps(query.cohesion_radius_squared);
+            const __m256 wrap_width       = _mm256_set1_ps(query.wrap_width);
+            const __m256 wrap_height      = _mm256_set1_ps(query.wrap_height);
+            const __m256 half_wrap_width  = _mm256_set1_ps(query.wrap_width / 2);
+            const __m256 half_wrap_height = _mm256_set1_ps(query.wrap_height / 2);
+            const __m256 one              = _mm256_set1_ps(1.0f);
+            const bool wraps              = query.wrap_width != 0;
+            const bool culls              = !query.cone.sees_all();
+
+            __m256 separation_count = _mm256_setzero_ps(), separation_x = _mm256_setzero_ps(), separation_y = _mm256_setzero_ps();
+            __m256 cohesion_count = _mm256_setzero_ps(), cohesion_x = _mm256_setzero_ps(), cohesion_y = _mm256_setzero_ps();
+            __m256 velocity_x = _mm256_setzero_ps(), velocity_y = _mm256_setzero_ps();
+
+            int j = first;
+            for (; j + 8 <= last; j += 8)
+            {
+                __m256 x = _mm256_loadu_ps(&state.pos_x[j]);
+                __m256 y = _mm256_loadu_ps(&state.pos_y[j]);
+
+                if (wraps)
+                {
+                    x = wrap_avx2(query_x, x, wrap_width, half_wrap_width);
+                    y = wrap_avx2(query_y, y, wrap_height, half_wrap_height);
+                }
+
+                const __m256 dx               = _mm256_sub_ps(x, query_x);
+                const __m256 dy               = _mm256_sub_ps(y, query_y);
+                const __m256 distance_squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+                __m256 is_separation = _mm256_cmp_ps(distance_squared, separation_sqr, _CMP_LT_OQ);
+                __m256 is_cohesion   = _mm256_cmp_ps(distance_squared, cohesion_sqr, _CMP_LT_OQ);
+
+                if (culls)
+                {
+                    const __m256 visible = in_view_avx2(dx, dy, distance_squared, query.cone);
+                    is_separation        = _mm256_and_ps(is_separation, visible);
+                    is_cohesion          = _mm256_and_ps(is_cohesion, visible);
+                }
+
+                separation_count = _mm256_add_ps(separation_count, _mm256_and_ps(is_separation, one));
+                separation_x     = _mm256_add_ps(separation_x, _mm256_and_ps(is_separation, x));
+                separation_y     = _mm256_add_ps(separation_y, _mm256_and_ps(is_separation, y));
+
+                cohesion_count = _mm256_add_ps(cohesion_count, _mm256_and_ps(is_cohesion, one));
+                cohesion_x     = _mm256_add_ps(cohesion_x, _mm256_and_ps(is_cohesion, x));
+                cohesion_y     = _mm256_add_ps(cohesion_y, _mm256_and_ps(is_cohesion, y));
+                velocity_x     = _mm256_add_ps(velocity_x, _mm256_and_ps(is_cohesion, _mm256_loadu_ps(&state.vel_x[j])));
+                velocity_y     = _mm256_add_ps(velocity_y, _mm256_and_ps(is_cohesion, _mm256_loadu_ps(&state.vel_y[j])));
+            }
+
+            sums.separation_count += horizontal_sum_avx2(separation_count);
+            sums.separation_x += horizontal_sum_avx2(separation_x);
+            sums.separation_y += horizontal_sum_avx2(separation_y);
+            sums.cohesion_count += horizontal_sum_avx2(cohesion_count);
+            sums.cohesion_x += horizontal_sum_avx2(cohesion_x);
+            sums.cohesion_y += horizontal_sum_avx2(cohesion_y);
+            sums.velocity_x += horizontal_sum_avx2(velocity_x);
+            sums.velocity_y += horizontal_sum_avx2(velocity_y);
+
+            accumulate_scalar(query, state, j, last, sums);
+        }
+
+        // 16 lanes, the masks live in k registers and the tail is a masked load instead of a scalar loop
+        BOIDS_TARGET("avx512f")
+        inline __m512 wrap_avx512(__m512 origin, __m512 other, __m512 size, __m512 half_size)
+        {
+            const __m512 offset   = _mm512_sub_ps(other, origin);
+            const __mmask16 above = _mm512_cmp_ps_mask(offset, half_size, _CMP_GT_OQ);
+            const __mmask16 below = _mm512_cmp_ps_mask(offset, _mm512_sub_ps(_mm512_setzero_ps(), half_size), _CMP_LT_OQ);
+            return _mm512_mask_add_ps(_mm512_mask_sub_ps(other, above, other, size), below, other, size);
+        }
+
+        BOIDS_TARGET("avx512f")
+        inline __mmask16 in_view_avx512(__m512 dx, __m512 dy, __m512 distance_squared, const view_cone& cone)
+        {
+            const __m512 along = _mm512_add_ps(_mm512_mul_ps(dx, _mm512_set1_ps(cone.direction.x)), _mm512_mul_ps(dy, _mm512_set1_ps(cone.direction.y)));
+            const __m512 along_sqr = _mm512_mul_ps(along, along);
+            const __m512 bound     = _mm512_mul_ps(_mm512_set1_ps(cone.cos_half_angle * cone.cos_half_angle), distance_squared);
+            const __mmask16 ahead  = _mm512_cmp_ps_mask(along, _mm512_setzero_ps(), _CMP_GE_OQ);
+
+            return cone.cos_half_angle >= 0 ? __mmask16(ahead & _mm512_cmp_ps_mask(along_sqr, bound, _CMP_GE_OQ))
+                                            : __mmask16(ahead | _mm512_cmp_ps_mask(along_sqr, bound, _CMP_LE_OQ));
+        }
+
+        // by hand, GCC's _mm512_reduce_add_ps extracts the halves through _mm256_undefined_pd and warns under -Wall
+        BOIDS_TARGET("avx512f")
+        inline float horizontal_sum_avx512(__m512 value)
+        {
+            alignas(64) float lanes[16];
+            _mm512_store_ps(lanes, value);
+
+            float halves[8];
+            for (int i = 0; i < 8; i++)
+                halves[i] = lanes[i] + lanes[i + 8];
+
+            return ((halves[0] + halves[1]) + (halves[2] + halves[3])) + ((halves[4] + halves[5]) + (halves[6] + halves[7]));
+        }
+
+        BOIDS_TARGET("avx512f")
+        inline void accumulate_avx512(const kernel_query& query, const boid_state_block& state, int first, int last, kernel_sums& sums)
+        {
+            const __m512 query_x          = _mm512_set1_ps(query.x);
+            const __m512 query_y          = _mm512_set1_ps(query.y);
+            const __m512 separation_sqr   = _mm512_set1_ps(query.separation_radius_squared);
+            const __m512 cohesion_sqr     = _mm512_set1_ps(query.cohesion_radius_squared);
+            const __m512 wrap_width       = _mm512_set1_ps(query.wrap_width);
+            const __m512 wrap_height      = _mm512_set1_ps(query.wrap_height);
+            const __m512 half_wrap_width  = _mm512_set1_ps(query.wrap_width / 2);
+            const __m512 half_wrap_height = _mm512_set1_ps(query.wrap_height / 2);
+            const __m512 one              = _mm512_set1_ps(1.0f);
+            const bool wraps              = query.wrap_width != 0;
+            const bool culls              = !query.cone.sees_all();
+
+            __m512 separation_count = _mm512_setzero_ps(), separation_x = _mm512_setzero_ps(), separation_y = _mm512_setzero_ps();
+            __m512 cohesion_count = _mm512_setzero_ps(), cohesion_x = _mm512_setzero_ps(), cohesion_y = _mm512_setzero_ps();
+            __m512 velocity_x = _mm512_setzero_ps(), velocity_y = _mm512_setzero_ps();
+
+            for (int j = first; j < last; j += 16)
+            {
+                const __mmask16 lanes = last - j >= 16 ? __mmask16(0xffff) : __mmask16((1u << (last - j)) - 1);
+
+                __m512 x = _mm512_maskz_loadu_ps(lanes, &state.pos_x[j]);
+                __m512 y = _mm512_maskz_loadu_ps(lanes, &state.pos_y[j]);
+
+                if (wraps)
+                {
+                    x = wrap_avx512(query_x, x, wrap_width, half_wrap_width);
+                    y = wrap_avx512(query_y, y, wrap_height, half_wrap_height);
+                }
+
+                const __m512 dx               = _mm512_sub_ps(x, query_x);
+                const __m512 dy               = _mm512_sub_ps(y, query_y);
+                const __m512 distance_squared = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+
+                const __mmask16 visible       = culls ? __mmask16(lanes & in_view_avx512(dx, dy, distance_squared, query.cone)) : lanes;
+                const __mmask16 is_separation = _mm512_mask_cmp_ps_mask(visible, distance_squared, separation_sqr, _CMP_LT_OQ);
+                const __mmask16 is_cohesion   = _mm512_mask_cmp_ps_mask(visible, distance_squared, cohesion_sqr, _CMP_LT_OQ);
+
+                separation_count = _mm512_mask_add_ps(separation_count, is_separation, separation_count, one);
+                separation_x     = _mm512_mask_add_ps(separation_x, is_separation, separation_x, x);
+                separation_y     = _mm512_mask_add_ps(separation_y, is_separation, separation_y, y);
+
+                cohesion_count = _mm512_mask_add_ps(cohesion_count, is_cohesion, cohesion_count, one);
+                cohesion_x     = _mm512_mask_add_ps(cohesion_x, is_cohesion, cohesion_x, x);
+                cohesion_y     = _mm512_mask_add_ps(cohesion_y, is_cohesion, cohesion_y, y);
+                velocity_x     = _mm512_mask_add_ps(velocity_x, is_cohesion, velocity_x, _mm512_maskz_loadu_ps(is_cohesion, &state.vel_x[j]));
+                velocity_y     = _mm512_mask_add_ps(velocity_y, is_cohesion, velocity_y, _mm512_maskz_loadu_ps(is_cohesion, &state.vel_y[j]));
+            }
+
+            sums.separation_count += horizontal_sum_avx512(separation_count);
+            sums.separation_x += horizontal_sum_avx512(separation_x);
+            sums.separation_y += horizontal_sum_avx512(separation_y);
+            sums.cohesion_count += horizontal_sum_avx512(cohesion_count);
+            sums.cohesion_x += horizontal_sum_avx512(cohesion_x);
+            sums.cohesion_y += horizontal_sum_avx512(cohesion_y);
+            sums.velocity_x += horizontal_sum_avx512(velocity_x);
+            sums.velocity_y += horizontal_sum_avx512(velocity_y);
+        }
+#endif
+    } // namespace kernels
+
+    // isa has to be resolved already, see resolve_simd_isa
+    static neighbor_kernel get_neighbor_kernel(simd_isa isa)
+    {
+#ifdef BOIDS_SIMD_X86
+        switch (isa)
+        {
+            case simd_isa::sse42:
+                return kernels::accumulate_sse42;
+            case simd_isa::avx2:
+                return kernels::accumulate_avx2;
+            case simd_isa::avx512:
+                return kernels::accumulate_avx512;
+            default:
+                break;
+        }
+#endif
+        return kernels::accumulate_scalar;
+    }
+} // namespace boids
+
+#endif
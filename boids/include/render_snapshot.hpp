@@ -0,0 +1,75 @@
+#ifndef RENDER_SNAPSHOT_HPP
+#define RENDER_SNAPSHOT_HPP
+
+#include <raylib.h>
+
+#include <base_definitions.hpp>
+#include <entt/entt.hpp>
+#include <vector>
+
+// What render_process needs to draw every renderable, copied out of the registry so it can be drawn while the
+// simulation keeps writing the components.
+struct render_snapshot
+{
+    struct instance
+    {
+        Vector2 position;
+        Vector2 direction;
+        Color color;
+        int first_vertex;
+        int vertex_count;
+    };
+
+    std::vector<instance> instances;
+    std::vector<Vector2> vertices;
+
+    void capture(entt::registry& registry)
+    {
+        instances.clear();
+        vertices.clear();
+
+        auto render_view = registry.view<transform, renderable>();
+        for (auto [entity, transform_data, renderable_data] : render_view.each())
+        {
+            instances.push_back({transform_data.position, transform_data.direction, renderable_data.color,
+                                 static_cast<int>(vertices.size()), static_cast<int>(renderable_data.vertices.size())});
+            vertices.insert(vertices.end(), renderable_data.vertices.begin(), renderable_data.vertices.end());
+        }
+    }
+};
+
+// Double buffer of the pipelined mode: the main thread draws the front snapshot, the state frame N ended with,
+// while the simulation of frame N+1 runs and is captured into the back one. swap() at the frame boundary, when
+// nothing reads or writes either of them. The front_buffer and back_buffer tags are what processes declare in
+// their component_list, so the task_graph keeps the drawing and the capture apart from each other only.
+struct render_snapshots
+{
+    struct front_buffer
+    {
+    };
+
+    struct back_buffer
+    {
+    };
+
+    const render_snapshot& front() const
+    {
+        return buffers[front_index];
+    }
+
+    render_snapshot& back()
+    {
+        return buffers[1 - front_index];
+    }
+
+    void swap()
+    {
+        front_index = 1 - front_index;
+    }
+
+   protected:
+    render_snapshot buffers[2];
+    int front_index = 0;
+};
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef STEERING_RULES_HPP
+#define STEERING_RULES_HPP
+
+#include <raylib.h>
+#include <raymath.h>
+
+#include <algorithm>
+#include <counter_rng.hpp>
+#include <neighbor_kernels.hpp>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace boids
+{
+    // a boid inside the neighborhood of the one being steered, position is already the nearest image
+    struct steering_neighbor
+    {
+        Vector2 position;
+        Vector2 velocity;
+        float distance_squared;
+    };
+
+    // the boid being steered
+    struct steering_boid
+    {
+        Vector2 position;
+        Vector2 velocity;
+        Vector2 target;
+        uint32_t id;
+        uint32_t frame;
+    };
+
+    // Base of the steering rules, every hook does nothing so a rule only writes the ones it needs.
+    // The per boid accumulator lives in state, the rule itself only holds the parameters:
+    //  - accumulate:      a neighbor inside the neighborhood (cohesion) radius
+    //  - accumulate_near: a neighbor inside the near (separation) radius
+    //  - accumulate_sums: the same neighbors already summed by a neighbor kernel
+    //  - accumulate_far:  a far cell summed as a whole, position_sum already shifted to the nearest image
+    //  - merge:           adds the state gathered by another chunk
+    //  - neighbor_count:  how many boids the state was gathered from, the pipeline takes the largest
+    //  - finalize:        the weighted force of the rule
+    struct steering_rule
+    {
+        struct state
+        {
+        };
+
+        Color debug_color = BLANK;
+
+        template <typename State>
+        void accumulate(State&, const steering_neighbor&) const {}
+
+        template <typename State>
+        void accumulate_near(State&, const steering_neighbor&) const {}
+
+        template <typename State>
+        void accumulate_sums(State&, const kernel_sums&) const {}
+
+        template <typename State>
+        void accumulate_far(State&, const cell_aggregate&) const {}
+
+        template <typename State>
+        void merge(State&, const State&) const {}
+
+        template <typename State>
+        int neighbor_count(const State&) const
+        {
+            return 0;
+        }
+    };
+
+    // steers away from the center of the near boids
+    struct separation_rule : steering_rule
+    {
+        struct state
+        {
+            int count      = 0;
+            Vector2 center = Vector2{0, 0};
+        };
+
+        float weight = 60;
+
+        separation_rule() { debug_color = GREEN; }
+
+        void accumulate_near(state& sums, const steering_neighbor& neighbor) const
+        {
+            sums.center = Vector2Add(sums.center, neighbor.position);
+            sums.count++;
+        }
+
+        void accumulate_sums(state& sums, const kernel_sums& kernel_result) const
+        {
+            sums.center = Vector2Add(sums.center, Vector2{kernel_result.separation_x, kernel_result.separation_y});
+            sums.count += static_cast<int>(kernel_result.separation_count);
+        }
+
+        void merge(state& sums, const state& other) const
+        {
+            sums.center = Vector2Add(sums.center, other.center);
+            sums.count += other.count;
+        }
+
+        Vector2 finalize(const state& sums, const steering_boid& self) const
+        {
+            if (sums.count == 0)
+                return Vector2Zero();
+
+            const Vector2 center = Vector2Scale(sums.center, 1.0f / sums.count);
+            return Vector2Scale(Vector2Normalize(Vector2Subtract(self.position, center)), weight);
+        }
+    };
+
+    // steers towards the center of the neighborhood
+    struct cohesion_rule : steering_rule
+    {
+        struct state
+        {
+            int count      = 0;
+            Vector2 center = Vector2{0, 0};
+        };
+
+        float weight = 30;
+
+        cohesion_rule() { debug_color = RED; }
+
+        void accumulate(state& sums, const steering_neighbor& neighbor) const
+        {
+            sums.center = Vector2Add(sums.center, neighbor.position);
+            sums.count++;
+        }
+
+        void accumulate_sums(state& sums, const kernel_sums& kernel_result) const
+        {
+            sums.center = Vector2Add(sums.center, Vector2{kernel_result.cohesion_x, kernel_result.cohesion_y});
+            sums.count += static_cast<int>(kernel_result.cohesion_count);
+        }
+
+        void accumulate_far(state& sums, const cell_aggregate& cell) const
+        {
+            sums.center = Vector2Add(sums.center, cell.position_sum);
+            sums.count += cell.count;
+        }
+
+        void merge(state& sums, const state& other) const
+        {
+            sums.center = Vector2Add(sums.center, other.center);
+            sums.count += other.count;
+        }
+
+        int neighbor_count(const state& sums) const
+        {
+            return sums.count;
+        }
+
+        Vector2 finalize(const state& sums, const steering_boid& self) const
+        {
+            if (sums.count == 0)
+                return Vector2Zero();
+
+            const Vector2 center = Vector2Scale(sums.center, 1.0f / sums.count);
+            return Vector2Scale(Vector2Normalize(Vector2Subtract(center, self.position)), weight);
+        }
+    };
+
+    // steers along the mean velocity of the neighborhood
+    struct alignment_rule : steering_rule
+    {
+        struct state
+        {
+            int count        = 0;
+            Vector2 velocity = Vector2{0, 0};
+        };
+
+        float weight = 15;
+
+        alignment_rule() { debug_color = BLUE; }
+
+        void accumulate(state& sums, const steering_neighbor& neighbor) const
+        {
+            sums.velocity = Vector2Add(sums.velocity, neighbor.velocity);
+            sums.count++;
+        }
+
+        void accumulate_sums(state& sums, const kernel_sums& kernel_result) const
+        {
+            sums.velocity = Vector2Add(sums.velocity, Vector2{kernel_result.velocity_x, kernel_result.velocity_y});
+            sums.count += static_cast<int>(kernel_result.cohesion_count);
+        }
+
+        void accumulate_far(state& sums, const cell_aggregate& cell) const
+        {
+            sums.velocity = Vector2Add(sums.velocity, cell.velocity_sum);
+            sums.count += cell.count;
+        }
+
+        void merge(state& sums, const state& other) const
+        {
+            sums.velocity = Vector2Add(sums.velocity, other.velocity);
+            sums.count += other.count;
+        }
+
+        int neighbor_count(const state& sums) const
+        {
+            return sums.count;
+        }
+
+        Vector2 finalize(const state& sums, const steering_boid&) const
+        {
+            Vector2 velocity = sums.velocity;
+            if (sums.count > 0)
+                velocity = Vector2Scale(velocity, 1.0f / sums.count);
+
+            return Vector2Scale(Vector2Normalize(velocity), weight);
+        }
+    };
+
+    // steers towards steering_boid::target, at full weight from reach away, weaker when closer
+    struct target_rule : steering_rule
+    {
+        float weight = 5;
+        float reach  = 80;
+
+        target_rule() { debug_color = VIOLET; }
+
+        Vector2 finalize(const state&, const steering_boid& self) const
+        {
+            Vector2 offset           = Vector2Subtract(self.target, self.position);
+            float distance_to_target = Vector2Length(offset);
+            float target_scale       = std::clamp(distance_to_target, 0.0f, reach) * weight / reach;
+
+            return Vector2Scale(offset, target_scale / distance_to_target);
+        }
+    };
+
+    // random force in [-magnitude, magnitude) per axis, keyed on the boid id and the frame
+    struct noise_rule : steering_rule
+    {
+        float magnitude = 5;
+        counter_rng rng;
+
+        Vector2 finalize(const state&, const steering_boid& self) const
+        {
+            return Vector2{rng.uniform(self.id, self.frame, 0, -magnitude, magnitude),
+                           rng.uniform(self.id, self.frame, 1, -magnitude, magnitude)};
+        }
+    };
+
+    // Composes rules at compile time: every hook is a fold over the rules, so one neighbor pass feeds them
+    // all and the hooks a rule doesn't override inline to nothing. The total force is summed in rule order.
+    template <typename... Rules>
+    struct steering_pipeline
+    {
+        using state = std::tuple<typename Rules::state...>;
+
+        template <typename Rule>
+        static constexpr bool has = (std::is_same_v<Rule, Rules> || ...);
+
+        std::tuple<Rules...> rules;
+
+        template <typename Rule>
+        Rule& get()
+        {
+            return std::get<Rule>(rules);
+        }
+
+        void accumulate(state& sums, const steering_neighbor& neighbor) const
+        {
+            for_each_rule([&](const auto& rule, auto& rule_sums) { rule.accumulate(rule_sums, neighbor); }, sums);
+        }
+
+        void accumulate_near(state& sums, const steering_neighbor& neighbor) const
+        {
+            for_each_rule([&](const auto& rule, auto& rule_sums) { rule.accumulate_near(rule_sums, neighbor); }, sums);
+        }
+
+        void accumulate_sums(state& sums, const kernel_sums& kernel_result) const
+        {
+            for_each_rule([&](const auto& rule, auto& rule_sums) { rule.accumulate_sums(rule_sums, kernel_result); }, sums);
+        }
+
+        void accumulate_far(state& sums, const cell_aggregate& cell) const
+        {
+            for_each_rule([&](const auto& rule, auto& rule_sums) { rule.accumulate_far(rule_sums, cell); }, sums);
+        }
+
+        void merge(state& sums, const state& other) const
+        {
+            merge(sums, other, std::index_sequence_for<Rules...>{});
+        }
+
+        int neighbor_count(const state& sums) const
+        {
+            int count = 0;
+            for_each_rule([&](const auto& rule, const auto& rule_sums) { count = std::max(count, rule.neighbor_count(rule_sums)); }, sums);
+            return count;
+        }
+
+        // on_force(force, debug_color) sees the force of every rule
+        template <typename Func>
+        Vector2 finalize(const state& sums, const steering_boid& self, Func&& on_force) const
+        {
+            Vector2 total_force = Vector2Zero();
+
+            for_each_rule([&](const auto& rule, const auto& rule_sums) {
+                const Vector2 force = rule.finalize(rule_sums, self);
+                on_force(force, rule.debug_color);
+                total_force = Vector2Add(total_force, force);
+            }, sums);
+
+            return total_force;
+        }
+
+        Vector2 finalize(const state& sums, const steering_boid& self) const
+        {
+            return finalize(sums, self, [](Vector2, Color) {});
+        }
+
+       protected:
+        template <typename Func, typename State>
+        void for_each_rule(Func&& func, State& sums) const
+        {
+            for_each_rule(func, sums, std::index_sequence_for<Rules...>{});
+        }
+
+        template <typename Func, typename State, std::size_t... Index>
+        void for_each_rule(Func& func, State& sums, std::index_sequence<Index...>) const
+        {
+            (func(std::get<Index>(rules), std::get<Index>(sums)), ...);
+        }
+
+        template <std::size_t... Index>
+        void merge(state& sums, const state& other, std::index_sequence<Index...>) const
+        {
+            (std::get<Index>(rules).merge(std::get<Index>(sums), std::get<Index>(other)), ...);
+        }
+    };
+
+    // the rules of the interactive demo: flocking towards the mouse with some noise
+    using classic_rules = steering_pipeline<alignment_rule, separation_rule, cohesion_rule, target_rule, noise_rule>;
+
+    // plain flocking, no target and no noise, for headless runs
+    using free_flock_rules = steering_pipeline<alignment_rule, separation_rule, cohesion_rule>;
+} // namespace boids
+
+#endif
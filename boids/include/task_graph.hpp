@@ -0,0 +1,228 @@
+#ifndef TASK_GRAPH_HPP
+#define TASK_GRAPH_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <entt/entt.hpp>
+#include <functional>
+#include <iostream>
+#include <job_system.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The components (or any other shared type) a process touches. Every process attached to a task_graph declares
+//     using reads  = component_list<...>;
+//     using writes = component_list<...>;
+template <typename... Components>
+struct component_list
+{
+    static std::vector<entt::id_type> ids()
+    {
+        return {entt::type_hash<Components>::value()...};
+    }
+};
+
+// The window being drawn. Processes calling raylib's draw functions write it, so they run on the thread calling
+// task_graph::update (between BeginDrawing and EndDrawing) and in attach order.
+struct render_target
+{
+};
+
+// Runs processes as a dependency graph instead of entt::scheduler's fixed sequence. A process waits for every
+// process attached before it that it conflicts with: one of the two writes something the other reads or writes.
+// Processes that don't conflict run concurrently as jobs of the job_system, the calling thread runs every process
+// writing render_target and helps with the jobs. Unlike entt::scheduler, the attach order is the execution order.
+struct task_graph
+{
+    using delta_type = std::uint32_t;
+
+    explicit task_graph(job_system& jobs) :
+        jobs(jobs)
+    {
+    }
+
+    task_graph(const task_graph&)            = delete;
+    task_graph& operator=(const task_graph&) = delete;
+
+    template <typename Process, typename... Args>
+    Process& attach(Args&&... args)
+    {
+        auto process = std::make_shared<Process>(std::forward<Args>(args)...);
+
+        // like entt::scheduler, leaves the uninitialized state right away so the first update runs it
+        process->tick(0);
+
+        stage added;
+        added.name        = std::string(entt::type_id<Process>().name());
+        added.reads       = Process::reads::ids();
+        added.writes      = Process::writes::ids();
+        added.main_thread = touches(added.writes, {entt::type_hash<render_target>::value()});
+        added.tick        = [process](delta_type delta, void* data) { process->tick(delta, data); };
+
+        const int index = static_cast<int>(stages.size());
+        for (int earlier = 0; earlier < index; earlier++)
+        {
+            if (touches(stages[earlier].writes, added.reads) || touches(stages[earlier].writes, added.writes) ||
+                touches(stages[earlier].reads, added.writes))
+            {
+                added.dependencies.push_back(earlier);
+                stages[earlier].dependents.push_back(index);
+            }
+        }
+
+        stages.push_back(std::move(added));
+        return *process;
+    }
+
+    // prints every process with the ones it waits for
+    void print() const
+    {
+        for (const auto& current : stages)
+        {
+            std::cout << "task_graph: " << current.name << (current.main_thread ? " (main thread)" : "");
+            for (std::size_t i = 0; i < current.dependencies.size(); i++)
+                std::cout << (i == 0 ? " after " : ", ") << stages[current.dependencies[i]].name;
+            std::cout << std::endl;
+        }
+    }
+
+    // runs every process once and returns when all of them are done
+    void update(delta_type delta_time, void* data = nullptr)
+    {
+        start(delta_time, data);
+        wait();
+    }
+
+    // Launches every process once and returns right away, the workers run them meanwhile. Processes writing
+    // render_target only run once wait() is called. Must be joined by wait() before the next start().
+    void start(delta_type delta_time, void* data = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        assert(pending_count == 0);
+
+        started_at    = std::chrono::high_resolution_clock::now();
+        running       = true;
+        frame_delta   = delta_time;
+        frame_data    = data;
+        pending_count = static_cast<int>(stages.size());
+        main_thread_ready.clear();
+
+        for (int i = 0; i < static_cast<int>(stages.size()); i++)
+        {
+            stages[i].remaining = static_cast<int>(stages[i].dependencies.size());
+            if (stages[i].remaining == 0)
+                launch(i);
+        }
+    }
+
+    // returns when every process of the last start() is done, right away if there's none running
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (!running)
+            return;
+
+        while (pending_count > 0)
+        {
+            if (!main_thread_ready.empty())
+            {
+                int index = main_thread_ready.front();
+                main_thread_ready.erase(main_thread_ready.begin());
+
+                lock.unlock();
+                run(index);
+                lock.lock();
+                continue;
+            }
+
+            lock.unlock();
+            bool helped = jobs.run_one();
+            lock.lock();
+
+            // a finished stage wakes it up, the timeout lets it help with jobs queued meanwhile
+            if (!helped && pending_count > 0 && main_thread_ready.empty())
+                stages_changed.wait_for(lock, std::chrono::microseconds(200));
+        }
+
+        running = false;
+        lock.unlock();
+
+        auto end      = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - started_at);
+        std::cout << "task_graph took " << duration.count() << " microseconds" << std::endl;
+    }
+
+   protected:
+    struct stage
+    {
+        std::string name;
+        std::vector<entt::id_type> reads;
+        std::vector<entt::id_type> writes;
+        bool main_thread = false;
+
+        std::function<void(delta_type, void*)> tick;
+
+        std::vector<int> dependencies;
+        std::vector<int> dependents;
+        int remaining = 0;
+    };
+
+    static bool touches(const std::vector<entt::id_type>& lhs, const std::vector<entt::id_type>& rhs)
+    {
+        return std::any_of(lhs.begin(), lhs.end(), [&](entt::id_type id) {
+            return std::find(rhs.begin(), rhs.end(), id) != rhs.end();
+        });
+    }
+
+    // called with the lock held
+    void launch(int index)
+    {
+        if (stages[index].main_thread)
+        {
+            main_thread_ready.push_back(index);
+            return;
+        }
+
+        jobs.submit([this, index] { run(index); });
+    }
+
+    void run(int index)
+    {
+        stages[index].tick(frame_delta, frame_data);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (int dependent : stages[index].dependents)
+        {
+            if (--stages[dependent].remaining == 0)
+                launch(dependent);
+        }
+        pending_count--;
+
+        stages_changed.notify_all();
+    }
+
+    job_system& jobs;
+
+    std::vector<stage> stages;
+
+    std::mutex mutex;
+    std::condition_variable stages_changed;
+    std::vector<int> main_thread_ready;
+    int pending_count = 0;
+    bool running      = false;
+
+    std::chrono::high_resolution_clock::time_point started_at;
+
+    delta_type frame_delta = 0;
+    void* frame_data       = nullptr;
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include <base_definitions.hpp>
 #include <base_processors.hpp>
 #include <boids.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
@@ -113,29 +116,305 @@ void random_block(entt::registry& registry)
     registry.emplace<renderable>(block, renderable{BLUE, 1, corners});
 }
 
+// Times the parallel movement_process and boids_constraints_process on 1 to thread_count threads, the caller
+// counting as one, and prints their speedup over a single thread. Their own timing output is muted meanwhile.
+void report_scaling(int boids_count, int frames = 100)
+{
+    const int max_threads = job_system::default_worker_count() + 1;
+
+    double single_movement    = 0;
+    double single_constraints = 0;
+
+    std::cout << "threads, movement_process us, speedup, boids_constraints_process us, speedup" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads++)
+    {
+        entt::registry registry;
+        registry.ctx().emplace<job_system>(threads - 1);
+        boids::create_n_boids(registry, boids_count, Vector2{400, 300}, 400);
+
+        movement_process movement(registry, true);
+        boids_constraints_process constraints(registry, world_bounds::screen, 0, 0, true);
+
+        std::chrono::nanoseconds movement_time(0);
+        std::chrono::nanoseconds constraints_time(0);
+
+        std::cout.setstate(std::ios::failbit);
+        for (int frame = 0; frame < frames; frame++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            movement.update(16, nullptr);
+            auto middle = std::chrono::high_resolution_clock::now();
+            constraints.update(16, nullptr);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            movement_time += middle - start;
+            constraints_time += end - middle;
+        }
+        std::cout.clear();
+
+        const double movement_us    = std::chrono::duration<double, std::micro>(movement_time).count() / frames;
+        const double constraints_us = std::chrono::duration<double, std::micro>(constraints_time).count() / frames;
+        if (threads == 1)
+        {
+            single_movement    = movement_us;
+            single_constraints = constraints_us;
+        }
+
+        std::cout << threads << ", " << movement_us << ", " << single_movement / movement_us << ", "
+                  << constraints_us << ", " << single_constraints / constraints_us << std::endl;
+    }
+}
+
+// Runs the same flock through boid_hashing_process, movement_process and boids_constraints_process, and through
+// fused_integration_process, and compares the transform, movement and cell of every boid after each frame.
+// Returns false, after printing the first frame that differs, when the two aren't identical.
+bool check_fused(int frames)
+{
+    entt::registry separate;
+    entt::registry fused;
+    for (auto* registry : {&separate, &fused})
+    {
+        registry->ctx().emplace<job_system>();
+        boids::create_n_boids(*registry, 500, Vector2{400, 300}, 400, boids::grid(40, boids::grid_backend::dense));
+    }
+
+    std::cout.setstate(std::ios::failbit);
+
+    boids::boid_hashing_process separate_hashing(separate, boids::hashing_mode::parallel_rebuild);
+    boids::boid_algo_process separate_algo(separate);
+    movement_process separate_movement(separate, true);
+    boids_constraints_process separate_constraints(separate, world_bounds::screen, 0, 0, true);
+
+    boids::boid_algo_process fused_algo(fused);
+    boids::fused_integration_process integration(fused);
+
+    auto same_bits = [](const auto& a, const auto& b) { return std::memcmp(&a, &b, sizeof(a)) == 0; };
+
+    // like the fused pass, the separate path hashes the frame ahead of its flocking
+    separate_hashing.update(16, nullptr);
+
+    int mismatch = -1;
+    for (int frame = 0; frame < frames && mismatch == -1; frame++)
+    {
+        separate_algo.update(16, nullptr);
+        separate_movement.update(16, nullptr);
+        separate_constraints.update(16, nullptr);
+
+        fused_algo.update(16, nullptr);
+        integration.update(16, nullptr);
+
+        separate_hashing.update(16, nullptr);
+
+        for (auto [entity, transform_data, movement_data, boid_data] :
+             separate.view<transform, movement, boids::boid>().each())
+        {
+            auto [fused_transform, fused_movement, fused_boid] = fused.get<transform, movement, boids::boid>(entity);
+
+            if (!same_bits(transform_data, fused_transform) || !same_bits(movement_data, fused_movement) ||
+                boid_data.current_cell_id != fused_boid.current_cell_id)
+            {
+                mismatch = frame;
+                break;
+            }
+        }
+    }
+
+    std::cout.clear();
+
+    if (mismatch != -1)
+        std::cout << "check_fused: frame " << mismatch << " differs from the separate processes" << std::endl;
+    else
+        std::cout << "check_fused: " << frames << " frames identical to the separate processes" << std::endl;
+
+    return mismatch == -1;
+}
+
+// Hashes a flock on a screen and on a toroidal grid and walks what the far_field traversal adds up for every
+// boid, see for_each_streamed_source: every other boid inside far_field_radius has to be in exactly one of the
+// streamed ranges or aggregated cells, and none of the boids in more than one. Returns false, after printing the
+// first boid that isn't, when some boid is missed or counted twice.
+bool check_far_field()
+{
+    const float far_field_radius = 120.0f;
+
+    bool counted_once = true;
+    for (auto bounds : {world_bounds::screen, world_bounds::toroidal})
+    {
+        entt::registry registry;
+        registry.ctx().emplace<job_system>();
+        boids::create_n_boids(registry, 2000, Vector2{400, 300}, 400,
+                              boids::grid(40, 800, 600, bounds, boids::grid_backend::dense));
+
+        std::cout.setstate(std::ios::failbit);
+
+        boids::boid_hashing_process hashing(registry, boids::hashing_mode::parallel_rebuild);
+        boids::boid_algo_process algo(registry, boids::neighbor_traversal::far_field, boids::simd_isa::automatic,
+                                      boids::default_seed, PI, 1, far_field_radius);
+        hashing.update(16, nullptr);
+        algo.update(16, nullptr);
+
+        std::cout.clear();
+
+        auto grid_view        = registry.view<boids::grid>();
+        auto& grid_data       = grid_view.get<boids::grid>(grid_view.front());
+        const auto& state     = grid_data.state;
+        const int boids_count = static_cast<int>(grid_data.cell_entries.size());
+
+        std::vector<int> counted(boids_count);
+        for (int i = 0; i < boids_count && counted_once; i++)
+        {
+            std::fill(counted.begin(), counted.end(), 0);
+
+            algo.for_each_streamed_source(grid_data, i, true, boids::view_cone{}, [&](int first, int end) {
+                for (int j = first; j < end; j++)
+                    counted[j]++;
+            }, [&](int slot, const boids::cell_aggregate&) {
+                for (int j = grid_data.cell_start[slot]; j < grid_data.cell_start[slot] + grid_data.cell_length[slot]; j++)
+                    counted[j]++;
+            });
+
+            const Vector2 position = Vector2{state.pos_x[i], state.pos_y[i]};
+            for (int j = 0; j < boids_count; j++)
+            {
+                const Vector2 image = grid_data.nearest_image(position, Vector2{state.pos_x[j], state.pos_y[j]});
+                const bool inside   = Vector2DistanceSqr(image, position) < far_field_radius * far_field_radius;
+
+                if (counted[j] > 1 || (inside && counted[j] == 0))
+                {
+                    std::cout << "check_far_field: boid " << j << " is counted " << counted[j] << " times by boid " << i
+                              << (bounds == world_bounds::toroidal ? " on the toroidal grid" : " on the screen grid") << std::endl;
+                    counted_once = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (counted_once)
+        std::cout << "check_far_field: every boid inside far_field_radius counted once" << std::endl;
+
+    return counted_once;
+}
+
 static const Color background  = {15, 15, 15, 255};
 static const Color yellow      = {204, 191, 147, 255};
 static const Color yellow_var1 = {204, 184, 147, 255};
 static const Color yellow_dark = {153, 144, 111, 255};
 
-int main()
+int main(int argc, char** argv)
 {
+    // --simd=<scalar|sse4.2|avx2|avx512> forces the neighbor kernel, to compare them on the same machine
+    // --workers=<n> sizes the job system, 0 runs everything on the main thread
+    // --pipelined draws the last frame's snapshot while the workers simulate the next one
+    // --scaling=<boids> prints how movement and constraints scale with the thread count and exits
+    // --fused integrates, constrains and rehashes the boids in one pass, see fused_integration_process
+    // --check-fused=<frames> compares the fused pass with the separate processes and exits
+    // --nearest=<k> flocks with the k nearest boids instead of every boid in the cohesion radius
+    // --check-far-field checks that the far_field traversal counts every boid in its radius once and exits
+    auto simd          = boids::simd_isa::automatic;
+    int workers        = job_system::default_worker_count();
+    bool pipelined     = false;
+    int scaling_boids  = 0;
+    bool fused         = false;
+    int checked_frames = 0;
+    bool check_far     = false;
+    bool nearest       = false;
+    int nearest_count  = 7;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strncmp(argv[i], "--simd=", 7) == 0)
+            simd = boids::simd_isa_from_name(argv[i] + 7);
+        else if (std::strncmp(argv[i], "--workers=", 10) == 0)
+            workers = std::atoi(argv[i] + 10);
+        else if (std::strcmp(argv[i], "--pipelined") == 0)
+            pipelined = true;
+        else if (std::strncmp(argv[i], "--scaling=", 10) == 0)
+            scaling_boids = std::atoi(argv[i] + 10);
+        else if (std::strcmp(argv[i], "--fused") == 0)
+            fused = true;
+        else if (std::strncmp(argv[i], "--check-fused=", 14) == 0)
+            checked_frames = std::atoi(argv[i] + 14);
+        else if (std::strncmp(argv[i], "--nearest=", 10) == 0)
+        {
+            nearest       = true;
+            nearest_count = std::atoi(argv[i] + 10);
+        }
+        else if (std::strcmp(argv[i], "--check-far-field") == 0)
+            check_far = true;
+    }
+
     InitWindow(800, 600, "BOIDS");
     SetRandomSeed(100);
 
-    entt::registry registry = entt::registry();
+    if (scaling_boids > 0)
+    {
+        report_scaling(scaling_boids);
+        return 0;
+    }
 
-    boids::create_n_boids(registry, 500, Vector2{400, 300}, 400);
+    if (checked_frames > 0)
+        return check_fused(checked_frames) ? 0 : 1;
 
-    entt::scheduler general_scheduler;
-    general_scheduler.attach<boids_constraints_process>(registry);
-    general_scheduler.attach<movement_process>(registry);
-    general_scheduler.attach<boids::boid_algo_process>(registry);
-    general_scheduler.attach<boids::boid_hashing_process>(registry);
+    if (check_far)
+        return check_far_field() ? 0 : 1;
 
-    entt::scheduler render_scheduler;
-    // render_scheduler.attach<boids::cell_renderer_process>(registry);
-    render_scheduler.attach<render_process>(registry);
+    entt::registry registry = entt::registry();
+    auto& jobs              = registry.ctx().emplace<job_system>(workers);
+    auto& snapshots         = registry.ctx().emplace<render_snapshots>();
+
+    auto boids_grid = boids::grid(40, boids::grid_backend::dense);
+
+    boids::create_n_boids(registry, 500, Vector2{400, 300}, 400, boids_grid);
+
+    // one graph for the whole frame, processes run in attach order only where they touch the same components,
+    // see task_graph. The boids are drawn where the last frame left them while the grid is tuned and hashed and
+    // the flocking rule runs on the workers, and the debug overlays of this frame are drawn on top at the end.
+    // Pipelined, the simulation stages get a graph of their own, started at the end of a frame so the workers
+    // run it while EndDrawing presents that frame, and joined at the start of the next one. frame_graph then
+    // only draws the snapshot the simulation captured and the debug overlays of the same simulation frame.
+    task_graph frame_graph(jobs);
+    task_graph simulation_graph(jobs);
+    task_graph& simulation = pipelined ? simulation_graph : frame_graph;
+    if (pipelined)
+        frame_graph.attach<snapshot_render_process>(registry);
+    else
+        frame_graph.attach<render_process>(registry);
+    // frame_graph.attach<boids::cell_renderer_process>(registry);
+    if (!fused)
+    {
+        simulation.attach<boids::grid_tuning_process>(registry, 80.0f);
+        simulation.attach<boids::boid_hashing_process>(registry, boids::hashing_mode::parallel_rebuild);
+    }
+    // boids see 135 degrees to each side of their heading, the blind spot is behind them, and the ones
+    // in sparse regions far from the target recompute their steering down to every 4th frame
+    const auto traversal = nearest ? boids::neighbor_traversal::nearest : boids::neighbor_traversal::streamed;
+    simulation.attach<boids::boid_algo_process>(registry, traversal, simd, boids::default_seed, 135 * DEG2RAD, 4, 160.0f,
+                                                nearest_count);
+    if (fused)
+    {
+        // the tuning measures this frame's flocking and the fused pass fills the grid it may have resized
+        simulation.attach<boids::grid_tuning_process>(registry, 80.0f);
+        simulation.attach<boids::fused_integration_process>(registry);
+    } else
+    {
+        simulation.attach<movement_process>(registry, true);
+        simulation.attach<boids_constraints_process>(registry, world_bounds::screen, 0, 0, true);
+    }
+    simulation.attach<boids::boid_reorder_process>(registry, 60);
+    if (pipelined)
+        simulation.attach<snapshot_capture_process>(registry);
+    frame_graph.attach<debug_draw_process>();
+    frame_graph.print();
+    if (pipelined)
+        simulation_graph.print();
+
+    // the first frame draws the boids where they were created. The simulation runs while the main thread is in
+    // EndDrawing, which polls the input, so the target is sampled for it beforehand
+    if (pipelined)
+    {
+        snapshots.back().capture(registry);
+        registry.ctx().emplace<boids::steering_target>(GetMousePosition());
+    }
 
     SetTargetFPS(60);
     while (!WindowShouldClose())
@@ -148,10 +427,23 @@ int main()
         DrawFPS(10, 40);
 
         auto delta_time = GetFrameTime() * 1000;
-        general_scheduler.update(delta_time);
+        if (pipelined)
+        {
+            simulation_graph.wait();
+            snapshots.swap();
+        }
+
+        frame_graph.update(delta_time);
+
+        if (pipelined)
+        {
+            registry.ctx().get<boids::steering_target>().position = GetMousePosition();
+            simulation_graph.start(delta_time);
+        }
 
-        render_scheduler.update(delta_time);
         EndDrawing();
     }
+
+    simulation_graph.wait();
     return 0;
 }